@@ -0,0 +1,395 @@
+/*
+ * Throughput benchmarks of the SHA-1 kernels, the hash backends, and the
+ * whole read + hash pipeline of verify() on a generated dataset.
+ * Output is tab separated, one measurement per line, after a header line.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "sha1.h"
+#include "sha1_mb.h"
+#include "hash.h"
+#include "metainfo.h"
+#include "verify.h"
+#include "opts.h"
+
+#define KiB (1024L)
+#define MiB (1024L * KiB)
+
+/* Hashed buffers are taken from this, so they don't all sit in the cache */
+#define BENCH_BUF_SIZE (128 * MiB)
+#define BENCH_MIN_SIZE (16 * KiB)
+#define BENCH_MAX_SIZE (64 * MiB)
+
+/* The dataset is split into this many files, so pieces span files */
+#define BENCH_DATASET_FILES 8
+#define BENCH_DATASET_NAME "data"
+
+static const long bench_piece_sizes[] = { 256 * KiB, 1 * MiB, 4 * MiB, 16 * MiB };
+#define BENCH_PIECE_SIZES_LEN (sizeof(bench_piece_sizes) / sizeof(bench_piece_sizes[0]))
+
+static double bench_min_time = 0.25;
+static const char* bench_dir = "/dev/shm";
+static long bench_dataset_size = 256 * MiB;
+static int bench_skip_pipeline = 0;
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char* bench, const char* name, long size, \
+        long long bytes, double seconds) {
+    printf("%s\t%s\t%ld\t%lld\t%.6f\t%.1f\n", bench, name, size, bytes, \
+            seconds, bytes / seconds / 1e6);
+    fflush(stdout);
+}
+
+/* Fill with something that's not all zeros, cheaply */
+static void bench_fill(uint8_t* buf, long size, uint64_t* seed) {
+    uint64_t x = *seed;
+    for (long i = 0; i + 8 <= size; i += 8) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(buf + i, &x, 8);
+    }
+    *seed = x;
+}
+
+/* The lane'th buffer of size bytes from the big buffer */
+static const uint8_t* bench_lane_buf(const uint8_t* buf, int lane, long size) {
+    return buf + ((long)lane * size) % (BENCH_BUF_SIZE - size + 1);
+}
+
+static void bench_sha1_kernels(const uint8_t* buf) {
+    int count;
+    const sha1_kernel_t* kernels = sha1_kernels(&count);
+
+    for (int i = 0; i < count; i++) {
+        if (sha1_kernel_select(kernels[i].name) == -1)
+            continue;
+
+        for (long size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 2) {
+            long long bytes = 0;
+            double start = bench_now(), elapsed;
+            do {
+                SHA1_CTX ctx;
+                unsigned char digest[20];
+                SHA1Init(&ctx);
+                SHA1Update(&ctx, buf, size);
+                SHA1Final(digest, &ctx);
+                bytes += size;
+                elapsed = bench_now() - start;
+            } while (elapsed < bench_min_time);
+            bench_report("sha1", kernels[i].name, size, bytes, elapsed);
+        }
+    }
+    sha1_kernel_select(NULL);
+}
+
+static void bench_sha1_mb_kernels(const uint8_t* buf) {
+    int count;
+    const sha1_mb_kernel_t* kernels = sha1_mb_kernels(&count);
+    const unsigned char* data[SHA1_MB_MAX_LANES];
+    unsigned char digests[SHA1_MB_MAX_LANES][20];
+
+    for (int i = 0; i < count; i++) {
+        if (sha1_mb_kernel_select(kernels[i].name) == -1)
+            continue;
+        int lanes = kernels[i].lanes;
+
+        for (long size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 2) {
+            for (int l = 0; l < lanes; l++)
+                data[l] = bench_lane_buf(buf, l, size);
+
+            long long bytes = 0;
+            double start = bench_now(), elapsed;
+            do {
+                sha1_mb(data, size, digests, lanes);
+                bytes += size * lanes;
+                elapsed = bench_now() - start;
+            } while (elapsed < bench_min_time);
+            bench_report("sha1_mb", kernels[i].name, size, bytes, elapsed);
+        }
+    }
+    sha1_mb_kernel_select(NULL);
+}
+
+static void bench_hash_backends(const uint8_t* buf) {
+    int count;
+    const hash_backend_t* const* backends = hash_backends(&count);
+    const unsigned char* data[HASH_MAX_LANES];
+    unsigned char digests[HASH_MAX_LANES][HASH_SHA1_LEN];
+
+    for (int i = 0; i < count; i++) {
+        if (hash_backend_select(backends[i]->name) == -1)
+            continue;
+        hash_ctx_t* ctx = hash_ctx_new();
+        if (!ctx)
+            continue;
+        int lanes = hash_lanes();
+
+        for (long size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 2) {
+            for (int l = 0; l < lanes; l++)
+                data[l] = bench_lane_buf(buf, l, size);
+
+            long long bytes = 0;
+            double start = bench_now(), elapsed;
+            do {
+                if (hash_batch(ctx, data, size, digests, lanes) == -1)
+                    break;
+                bytes += size * lanes;
+                elapsed = bench_now() - start;
+            } while (elapsed < bench_min_time);
+            bench_report("backend", backends[i]->name, size, bytes, elapsed);
+        }
+        hash_ctx_free(ctx);
+    }
+    hash_backend_select("builtin");
+}
+
+typedef struct {
+    char data_dir[4096];
+    char file_path[BENCH_DATASET_FILES][4096 + 32];
+    long file_size[BENCH_DATASET_FILES];
+    char torrent_path[BENCH_PIECE_SIZES_LEN][4096 + 32];
+} bench_dataset_t;
+
+/*
+ * Feed the data to the piece hashers of every piece size, and append
+ * the piece hashes when a piece is done
+ */
+typedef struct {
+    SHA1_CTX ctx;
+    long piece_size, piece_fill;
+    unsigned char* pieces;
+    long pieces_len;
+} bench_piece_hasher_t;
+
+static void bench_piece_hasher_feed(bench_piece_hasher_t* h, const uint8_t* data, long len) {
+    while (len > 0) {
+        long n = h->piece_size - h->piece_fill;
+        if (n > len)
+            n = len;
+        if (h->piece_fill == 0)
+            SHA1Init(&h->ctx);
+        SHA1Update(&h->ctx, data, n);
+        h->piece_fill += n;
+        data += n;
+        len -= n;
+        if (h->piece_fill == h->piece_size) {
+            SHA1Final(h->pieces + h->pieces_len, &h->ctx);
+            h->pieces_len += 20;
+            h->piece_fill = 0;
+        }
+    }
+}
+
+static void bench_piece_hasher_finish(bench_piece_hasher_t* h) {
+    if (h->piece_fill > 0) {
+        SHA1Final(h->pieces + h->pieces_len, &h->ctx);
+        h->pieces_len += 20;
+        h->piece_fill = 0;
+    }
+}
+
+static int bench_write_torrent(bench_dataset_t* ds, const char* path, \
+        bench_piece_hasher_t* h) {
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    fprintf(f, "d4:infod5:filesl");
+    for (int i = 0; i < BENCH_DATASET_FILES; i++) {
+        const char* name = strrchr(ds->file_path[i], '/') + 1;
+        fprintf(f, "d6:lengthi%lde4:pathl%zu:%see", ds->file_size[i], strlen(name), name);
+    }
+    fprintf(f, "e4:name%zu:%s12:piece lengthi%lde6:pieces%ld:", \
+            strlen(BENCH_DATASET_NAME), BENCH_DATASET_NAME, h->piece_size, h->pieces_len);
+    fwrite(h->pieces, 1, h->pieces_len, f);
+    fprintf(f, "ee");
+
+    return (fclose(f) == 0) ? 0 : -1;
+}
+
+static int bench_dataset_create(bench_dataset_t* ds, uint8_t* buf) {
+    bench_piece_hasher_t hashers[BENCH_PIECE_SIZES_LEN] = {0};
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    int result = -1;
+
+    snprintf(ds->data_dir, sizeof(ds->data_dir), "%s/torrent-verify-bench.XXXXXX", bench_dir);
+    if (!mkdtemp(ds->data_dir))
+        return -1;
+
+    char content_dir[sizeof(ds->data_dir) + 32];
+    snprintf(content_dir, sizeof(content_dir), "%s/" BENCH_DATASET_NAME, ds->data_dir);
+    if (mkdir(content_dir, 0700) == -1)
+        return -1;
+
+    for (int i = 0; i < BENCH_PIECE_SIZES_LEN; i++) {
+        hashers[i].piece_size = bench_piece_sizes[i];
+        hashers[i].pieces = malloc((bench_dataset_size / bench_piece_sizes[i] + \
+                    BENCH_DATASET_FILES + 1) * 20);
+        if (!hashers[i].pieces)
+            goto end;
+    }
+
+    /* Uneven file sizes, so pieces start at odd offsets in files */
+    long remaining = bench_dataset_size;
+    for (int i = 0; i < BENCH_DATASET_FILES; i++) {
+        long size = (i == BENCH_DATASET_FILES - 1) ? remaining : \
+                    bench_dataset_size / BENCH_DATASET_FILES + (i - 3) * 4099;
+        if (size > remaining)
+            size = remaining;
+        remaining -= size;
+        ds->file_size[i] = size;
+        snprintf(ds->file_path[i], sizeof(ds->file_path[i]), "%s/file%d", content_dir, i);
+
+        FILE* f = fopen(ds->file_path[i], "wb");
+        if (!f)
+            goto end;
+        while (size > 0) {
+            long n = (size < MiB) ? size : MiB;
+            bench_fill(buf, MiB, &seed);
+            fwrite(buf, 1, n, f);
+            for (int j = 0; j < BENCH_PIECE_SIZES_LEN; j++)
+                bench_piece_hasher_feed(&hashers[j], buf, n);
+            size -= n;
+        }
+        if (fclose(f) != 0)
+            goto end;
+    }
+
+    for (int i = 0; i < BENCH_PIECE_SIZES_LEN; i++) {
+        bench_piece_hasher_finish(&hashers[i]);
+        snprintf(ds->torrent_path[i], sizeof(ds->torrent_path[i]), \
+                "%s/%ld.torrent", ds->data_dir, bench_piece_sizes[i]);
+        if (bench_write_torrent(ds, ds->torrent_path[i], &hashers[i]) == -1)
+            goto end;
+    }
+    result = 0;
+
+end:
+    for (int i = 0; i < BENCH_PIECE_SIZES_LEN; i++)
+        free(hashers[i].pieces);
+    return result;
+}
+
+static void bench_dataset_destroy(bench_dataset_t* ds) {
+    for (int i = 0; i < BENCH_DATASET_FILES; i++)
+        unlink(ds->file_path[i]);
+    for (int i = 0; i < BENCH_PIECE_SIZES_LEN; i++)
+        unlink(ds->torrent_path[i]);
+
+    char content_dir[sizeof(ds->data_dir) + 32];
+    snprintf(content_dir, sizeof(content_dir), "%s/" BENCH_DATASET_NAME, ds->data_dir);
+    rmdir(content_dir);
+    rmdir(ds->data_dir);
+}
+
+static int bench_pipeline(uint8_t* buf) {
+    bench_dataset_t ds = {0};
+    int count;
+    const hash_backend_t* const* backends = hash_backends(&count);
+
+    if (bench_dataset_create(&ds, buf) == -1) {
+        fprintf(stderr, "Creating the dataset in %s failed: %s\n", \
+                bench_dir, strerror(errno));
+        bench_dataset_destroy(&ds);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (hash_backend_select(backends[i]->name) == -1)
+            continue;
+
+        for (int j = 0; j < BENCH_PIECE_SIZES_LEN; j++) {
+            metainfo_t m;
+            if (metainfo_create(&m, ds.torrent_path[j]) == -1)
+                continue;
+
+            long long bytes = 0;
+            double start = bench_now(), elapsed;
+            do {
+                if (verify(&m, ds.data_dir, 1) != 0) {
+                    fprintf(stderr, "Verifying the dataset failed\n");
+                    break;
+                }
+                bytes += bench_dataset_size;
+                elapsed = bench_now() - start;
+            } while (elapsed < bench_min_time);
+            if (bytes > 0)
+                bench_report("pipeline", backends[i]->name, bench_piece_sizes[j], \
+                        bytes, elapsed);
+
+            metainfo_destroy(&m);
+        }
+    }
+    hash_backend_select("builtin");
+
+    bench_dataset_destroy(&ds);
+    return 0;
+}
+
+static void bench_usage() {
+    fprintf(stderr, "Usage: " PROGRAM_NAME "-bench [-d DIR] [-s MiB] [-t SECONDS] [-P]\n"
+            "   -d DIR      create the pipeline dataset in DIR (default: %s)\n"
+            "   -s MiB      size of the pipeline dataset (default: %ld)\n"
+            "   -t SECONDS  minimum time of one measurement (default: %.2f)\n"
+            "   -P          skip the pipeline benchmark\n", \
+            bench_dir, bench_dataset_size / MiB, bench_min_time);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:t:P")) != -1) {
+        switch (opt) {
+            case 'd':
+                bench_dir = optarg;
+                break;
+            case 's':
+                bench_dataset_size = atol(optarg) * MiB;
+                if (bench_dataset_size <= 0)
+                    bench_usage();
+                break;
+            case 't':
+                bench_min_time = atof(optarg);
+                break;
+            case 'P':
+                bench_skip_pipeline = 1;
+                break;
+            default:
+                bench_usage();
+        }
+    }
+
+    uint8_t* buf = malloc(BENCH_BUF_SIZE);
+    if (!buf) {
+        perror("Allocating the buffer failed");
+        return EXIT_FAILURE;
+    }
+    uint64_t seed = 1;
+    bench_fill(buf, BENCH_BUF_SIZE, &seed);
+
+    opt_silent = 1;
+    printf("bench\tname\tsize\tbytes\tseconds\tMBps\n");
+    bench_sha1_kernels(buf);
+    bench_sha1_mb_kernels(buf);
+    bench_hash_backends(buf);
+    int result = 0;
+    if (!bench_skip_pipeline)
+        result = bench_pipeline(buf);
+
+    free(buf);
+    return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
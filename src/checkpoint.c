@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "metainfo.h"
+#include "opts.h"
+#include "util.h"
+
+#define CHECKPOINT_MAGIC "torrent-verify checkpoint 1\n"
+
+/*
+ * Write the pieces as a hex bitfield, from the highest bit of the first byte
+ */
+static void checkpoint_write_bits(FILE* f, const char* name, const uint8_t* pieces, int count) {
+    static const char digits[] = "0123456789abcdef";
+
+    fprintf(f, "%s ", name);
+    for (int i = 0; i < count; i += 8) {
+        unsigned int byte = 0;
+        for (int j = 0; j < 8 && i + j < count; j++) {
+            if (pieces[i + j])
+                byte |= 0x80 >> j;
+        }
+        putc(digits[byte >> 4], f);
+        putc(digits[byte & 0xf], f);
+    }
+    putc('\n', f);
+}
+
+static int checkpoint_hex(int c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*
+ * Read a bitfield written by checkpoint_write_bits, and set the pieces in it
+ * Returns 0 on success, -1 if it's not valid
+ */
+static int checkpoint_read_bits(FILE* f, const char* name, uint8_t* pieces, int count) {
+    char label[16];
+
+    if (fscanf(f, "%15s", label) != 1 || strcmp(label, name) != 0 || getc(f) != ' ')
+        return -1;
+    for (int i = 0; i < count; i += 8) {
+        int high = checkpoint_hex(getc(f));
+        int low = checkpoint_hex(getc(f));
+        if (high == -1 || low == -1)
+            return -1;
+        for (int j = 0; j < 8 && i + j < count; j++) {
+            if (((high << 4) | low) & (0x80 >> j))
+                pieces[i + j] = 1;
+        }
+    }
+    return (getc(f) == '\n') ? 0 : -1;
+}
+
+int checkpoint_save(const char* path, const checkpoint_t* c) {
+    char hash[sizeof(sha1sum_t) * 2 + 1];
+    size_t path_len = strlen(path);
+    int result = -1;
+
+    char* tmp = malloc(path_len + sizeof(".XXXXXX"));
+    if (!tmp) {
+        fprintf(stderr, "Can't allocate the checkpoint path\n");
+        return -1;
+    }
+    memcpy(tmp, path, path_len);
+    memcpy(tmp + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(tmp);
+    FILE* f = (fd == -1) ? NULL : fdopen(fd, "w");
+    if (!f) {
+        perror(tmp);
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return -1;
+    }
+
+    int verified = 0;
+    while (verified < c->piece_count && c->done[verified])
+        verified++;
+    util_byte2hex(c->info_hash, sizeof(sha1sum_t), 0, hash);
+    fputs(CHECKPOINT_MAGIC, f);
+    fprintf(f, "infohash %s\npieces %d\nverified %d\nfiles %d\n", \
+            hash, c->piece_count, verified, c->file_count);
+    for (int i = 0; i < c->file_count; i++) {
+        const checkpoint_file_t* file = &c->files[i];
+        fprintf(f, "%ld %lu %ld.%09ld\n", file->size, file->inode, \
+                file->mtime_sec, file->mtime_nsec);
+    }
+    checkpoint_write_bits(f, "done", c->done, c->piece_count);
+    checkpoint_write_bits(f, "bad", c->bad, c->piece_count);
+
+    /* It's only renamed over the old one when it's all on the disk */
+    if (fflush(f) == 0 && !ferror(f) && fsync(fd) == 0)
+        result = 0;
+    if (fclose(f) != 0)
+        result = -1;
+    if (result == 0 && rename(tmp, path) == -1)
+        result = -1;
+    if (result == -1) {
+        perror(path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return result;
+}
+
+int checkpoint_load(const char* path, checkpoint_t* c) {
+    char line[sizeof(CHECKPOINT_MAGIC)];
+    char hash[sizeof(sha1sum_t) * 2 + 1], file_hash[sizeof(hash)];
+    int piece_count, verified, file_count;
+    int result = 0;
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        if (errno == ENOENT)
+            return 0;
+        perror(path);
+        return -1;
+    }
+    /* Read into these, so nothing is set if it's not valid */
+    uint8_t* done = calloc(c->piece_count + 1, 1);
+    uint8_t* bad = calloc(c->piece_count + 1, 1);
+    if (!done || !bad) {
+        fprintf(stderr, "Can't allocate the checkpoint\n");
+        result = -1;
+        goto end;
+    }
+
+    util_byte2hex(c->info_hash, sizeof(sha1sum_t), 0, hash);
+    if (!fgets(line, sizeof(line), f) || strcmp(line, CHECKPOINT_MAGIC) != 0 || \
+            fscanf(f, "infohash %40s pieces %d verified %d files %d", \
+                file_hash, &piece_count, &verified, &file_count) != 4 || \
+            strcmp(hash, file_hash) != 0 || piece_count != c->piece_count || \
+            file_count != c->file_count || verified < 0 || verified > piece_count)
+        goto mismatch;
+
+    for (int i = 0; i < file_count; i++) {
+        const checkpoint_file_t* file = &c->files[i];
+        checkpoint_file_t was;
+        if (fscanf(f, "%ld %lu %ld.%ld", &was.size, &was.inode, \
+                    &was.mtime_sec, &was.mtime_nsec) != 4 || \
+                was.size != file->size || was.inode != file->inode || \
+                was.mtime_sec != file->mtime_sec || was.mtime_nsec != file->mtime_nsec)
+            goto mismatch;
+    }
+    if (getc(f) != '\n' || checkpoint_read_bits(f, "done", done, piece_count) == -1 || \
+            checkpoint_read_bits(f, "bad", bad, piece_count) == -1)
+        goto mismatch;
+
+    memset(c->done, 1, verified);
+    for (int i = 0; i < piece_count; i++) {
+        c->done[i] |= done[i];
+        c->bad[i] |= bad[i];
+    }
+    result = 1;
+    goto end;
+
+mismatch:
+    if (!opt_silent)
+        printf("The checkpoint %s is of other files, starting over\n", path);
+end:
+    free(done);
+    free(bad);
+    fclose(f);
+    return result;
+}
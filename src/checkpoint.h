@@ -0,0 +1,43 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+/* Saving how far verifying got, so a restarted run can go on from there */
+
+#include <stdint.h>
+
+/* What a file was like when it was verified. If it's still the same, the
+ * results stand */
+typedef struct {
+    /* -1 if the file is missing */
+    long int size;
+    unsigned long int inode;
+    long int mtime_sec, mtime_nsec;
+} checkpoint_file_t;
+
+typedef struct {
+    /* The SHA-1 info hash of the torrent */
+    const unsigned char* info_hash;
+    int piece_count;
+    const checkpoint_file_t* files;
+    int file_count;
+    /* A byte for every piece, 1 for the ones that are checked, and for the
+     * ones of those that are bad */
+    uint8_t* done;
+    uint8_t* bad;
+} checkpoint_t;
+
+/*
+ * Write the checkpoint to 'path' atomically: to a new file next to it,
+ * that replaces it when it's on the disk
+ * Returns 0 on success, -1 on error
+ */
+int checkpoint_save(const char* path, const checkpoint_t* c);
+
+/*
+ * Read the checkpoint at 'path' into done, and bad, if it's of the same
+ * torrent, and the files are the same as in 'c'
+ * Returns 1 if it's read, 0 if there is none, or it's of something else,
+ * -1 on error
+ */
+int checkpoint_load(const char* path, checkpoint_t* c);
+
+#endif
@@ -0,0 +1,252 @@
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha1.h"
+
+/* How long to let each backend hash in auto mode */
+#define HASH_AUTO_BENCH_NS (20 * 1000 * 1000)
+/* The size of the buffers hashed in auto mode */
+#define HASH_AUTO_BENCH_BUFSIZE (256 * 1024)
+
+/* Every backend has its own context type behind hash_ctx_t */
+typedef struct {
+    SHA1_CTX sha1;
+} builtin_ctx_t;
+
+static int builtin_is_available(void) {
+    return 1;
+}
+
+static hash_ctx_t* builtin_ctx_new(void) {
+    return (hash_ctx_t*)malloc(sizeof(builtin_ctx_t));
+}
+
+static void builtin_ctx_free(hash_ctx_t* ctx) {
+    free(ctx);
+}
+
+static int builtin_init(hash_ctx_t* ctx) {
+    SHA1Init(&((builtin_ctx_t*)ctx)->sha1);
+    return 0;
+}
+
+static int builtin_update(hash_ctx_t* ctx, const void* data, size_t len) {
+    SHA1Update(&((builtin_ctx_t*)ctx)->sha1, data, len);
+    return 0;
+}
+
+static int builtin_final(hash_ctx_t* ctx, unsigned char digest[HASH_SHA1_LEN]) {
+    SHA1Final(digest, &((builtin_ctx_t*)ctx)->sha1);
+    return 0;
+}
+
+static int builtin_batch(hash_ctx_t* ctx, const unsigned char* const data[], \
+        size_t len, unsigned char digests[][HASH_SHA1_LEN], int n) {
+    sha1_mb(data, len, digests, n);
+    return 0;
+}
+
+const hash_backend_t hash_backend_builtin = {
+    .name = "builtin",
+    .is_available = builtin_is_available,
+    .ctx_new = builtin_ctx_new,
+    .ctx_free = builtin_ctx_free,
+    .init = builtin_init,
+    .update = builtin_update,
+    .update_fd = NULL,
+    .final = builtin_final,
+    .lanes = sha1_mb_lanes,
+    .batch = builtin_batch,
+};
+
+static const hash_backend_t* const hash_backend_list[] = {
+    &hash_backend_builtin,
+#ifdef HASH_OPENSSL
+    &hash_backend_openssl,
+#endif
+#ifdef HASH_AF_ALG
+    &hash_backend_af_alg,
+#endif
+};
+#define HASH_BACKEND_COUNT (sizeof(hash_backend_list) / sizeof(hash_backend_list[0]))
+
+static const hash_backend_t* hash_backend = &hash_backend_builtin;
+/* "auto" is selected, but the benchmark hasn't run yet */
+static int hash_backend_auto = 0;
+
+const hash_backend_t* const* hash_backends(int* count) {
+    *count = HASH_BACKEND_COUNT;
+    return hash_backend_list;
+}
+
+/*
+ * Hash buffers with the backend for a while, the way verify does: from
+ * 'fd', a file of HASH_AUTO_BENCH_BUFSIZE bytes, if the backend can hash
+ * from files, otherwise from the memory
+ * Returns the bytes hashed per second, or -1 on error
+ */
+static double hash_backend_bench(const hash_backend_t* b, unsigned char* buffer, int fd) {
+    const hash_backend_t* prev = hash_backend;
+    const unsigned char* data[HASH_MAX_LANES];
+    unsigned char digests[HASH_MAX_LANES][HASH_SHA1_LEN];
+    struct timespec start, now;
+    long long elapsed, bytes = 0;
+    double result = -1;
+
+    hash_backend = b;
+    hash_ctx_t* ctx = hash_ctx_new();
+    if (!ctx)
+        goto end;
+
+    int lanes = hash_lanes();
+    for (int i = 0; i < lanes; i++)
+        data[i] = buffer + i * HASH_AUTO_BENCH_BUFSIZE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (b->update_fd && fd != -1) {
+            if (hash_init(ctx) == -1 || \
+                    hash_update_fd(ctx, fd, 0, HASH_AUTO_BENCH_BUFSIZE) == -1 || \
+                    hash_final(ctx, digests[0]) == -1)
+                goto end;
+            bytes += HASH_AUTO_BENCH_BUFSIZE;
+        } else {
+            if (hash_batch(ctx, data, HASH_AUTO_BENCH_BUFSIZE, digests, lanes) == -1)
+                goto end;
+            bytes += (long long)lanes * HASH_AUTO_BENCH_BUFSIZE;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000000000LL + (now.tv_nsec - start.tv_nsec);
+    } while (elapsed < HASH_AUTO_BENCH_NS);
+    result = bytes / (elapsed / 1e9);
+
+end:
+    if (ctx)
+        hash_ctx_free(ctx);
+    hash_backend = prev;
+    return result;
+}
+
+static int hash_backend_select_auto() {
+    const hash_backend_t* best = &hash_backend_builtin;
+    double best_speed = 0;
+
+    unsigned char* buffer = calloc(HASH_MAX_LANES, HASH_AUTO_BENCH_BUFSIZE);
+    if (!buffer)
+        return -1;
+    /* For the backends that hash from files, if it can't be made, they
+     * are measured from the memory */
+    FILE* tmp = tmpfile();
+    int fd = -1;
+    if (tmp && fwrite(buffer, HASH_AUTO_BENCH_BUFSIZE, 1, tmp) == 1 && fflush(tmp) == 0)
+        fd = fileno(tmp);
+
+    for (int i = 0; i < HASH_BACKEND_COUNT; i++) {
+        const hash_backend_t* b = hash_backend_list[i];
+        if (!b->is_available())
+            continue;
+        double speed = hash_backend_bench(b, buffer, fd);
+        if (speed > best_speed) {
+            best_speed = speed;
+            best = b;
+        }
+    }
+
+    if (tmp)
+        fclose(tmp);
+    free(buffer);
+    hash_backend = best;
+    return 0;
+}
+
+int hash_backend_select(const char* name) {
+    /* It's only measured when something is verified */
+    hash_backend_auto = (strcmp(name, "auto") == 0);
+    if (hash_backend_auto) {
+        hash_backend = &hash_backend_builtin;
+        return 0;
+    }
+
+    for (int i = 0; i < HASH_BACKEND_COUNT; i++) {
+        const hash_backend_t* b = hash_backend_list[i];
+        if (strcmp(name, b->name) != 0)
+            continue;
+        if (!b->is_available())
+            return -1;
+        hash_backend = b;
+        return 0;
+    }
+    return -1;
+}
+
+void hash_backend_resolve(void) {
+    if (!hash_backend_auto)
+        return;
+    hash_backend_auto = 0;
+    hash_backend_select_auto();
+}
+
+const hash_backend_t* hash_backend_current(void) {
+    return hash_backend;
+}
+
+hash_ctx_t* hash_ctx_new(void) {
+    return hash_backend->ctx_new();
+}
+
+void hash_ctx_free(hash_ctx_t* ctx) {
+    hash_backend->ctx_free(ctx);
+}
+
+int hash_init(hash_ctx_t* ctx) {
+    return hash_backend->init(ctx);
+}
+
+int hash_update(hash_ctx_t* ctx, const void* data, size_t len) {
+    return hash_backend->update(ctx, data, len);
+}
+
+int hash_final(hash_ctx_t* ctx, unsigned char digest[HASH_SHA1_LEN]) {
+    return hash_backend->final(ctx, digest);
+}
+
+int hash_can_update_fd(void) {
+    return hash_backend->update_fd != NULL;
+}
+
+int hash_update_fd(hash_ctx_t* ctx, int fd, off_t offset, size_t len) {
+    return hash_backend->update_fd(ctx, fd, offset, len);
+}
+
+int hash_lanes(void) {
+    return (hash_backend->lanes) ? hash_backend->lanes() : 1;
+}
+
+int hash_batch(hash_ctx_t* ctx, const unsigned char* const data[], size_t len, \
+        unsigned char digests[][HASH_SHA1_LEN], int n) {
+    if (hash_backend->batch)
+        return hash_backend->batch(ctx, data, len, digests, n);
+
+    for (int i = 0; i < n; i++) {
+        if (hash_init(ctx) == -1 || hash_update(ctx, data[i], len) == -1 || \
+                hash_final(ctx, digests[i]) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int hash_oneshot(const void* data, size_t len, unsigned char digest[HASH_SHA1_LEN]) {
+    int ret = -1;
+    hash_ctx_t* ctx = hash_ctx_new();
+    if (!ctx)
+        return -1;
+    if (hash_init(ctx) == 0 && hash_update(ctx, data, len) == 0 && \
+            hash_final(ctx, digest) == 0)
+        ret = 0;
+    hash_ctx_free(ctx);
+    return ret;
+}
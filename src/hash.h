@@ -0,0 +1,106 @@
+#ifndef HASH_H
+#define HASH_H
+/*
+ * SHA-1 hashing through a backend that can be selected at build time
+ * and at runtime
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "sha1_mb.h"
+
+#define HASH_SHA1_LEN 20
+/* No backend has more lanes than this */
+#define HASH_MAX_LANES SHA1_MB_MAX_LANES
+
+typedef struct hash_ctx hash_ctx_t;
+
+typedef struct {
+    const char* name;
+    /* Returns non-zero if the backend can be used on this system */
+    int (*is_available)(void);
+    /* Create a context, it can be reused for any number of hashes.
+     * Every thread needs its own. Returns NULL on error */
+    hash_ctx_t* (*ctx_new)(void);
+    void (*ctx_free)(hash_ctx_t* ctx);
+    /* These return 0 on success and -1 on error */
+    int (*init)(hash_ctx_t* ctx);
+    int (*update)(hash_ctx_t* ctx, const void* data, size_t len);
+    /* Hash 'len' bytes of 'fd' from 'offset' without copying them into
+     * userspace. NULL if the backend can't do this */
+    int (*update_fd)(hash_ctx_t* ctx, int fd, off_t offset, size_t len);
+    int (*final)(hash_ctx_t* ctx, unsigned char digest[HASH_SHA1_LEN]);
+    /* Hash 'n' buffers of 'len' bytes each, n <= lanes().
+     * NULL if the backend hashes one buffer at a time */
+    int (*lanes)(void);
+    int (*batch)(hash_ctx_t* ctx, const unsigned char* const data[], \
+            size_t len, unsigned char digests[][HASH_SHA1_LEN], int n);
+} hash_backend_t;
+
+extern const hash_backend_t hash_backend_builtin;
+#ifdef HASH_OPENSSL
+extern const hash_backend_t hash_backend_openssl;
+#endif
+#ifdef HASH_AF_ALG
+extern const hash_backend_t hash_backend_af_alg;
+#endif
+
+/*
+ * Get the compiled in backends
+ */
+const hash_backend_t* const* hash_backends(int* count);
+
+/*
+ * Select a backend by name. If name is "auto", the fastest is selected
+ * by hash_backend_resolve(), until then it's the builtin one.
+ * Not thread safe, call it before hashing starts.
+ * Returns 0 on success, -1 if there is no such or it's not available
+ */
+int hash_backend_select(const char* name);
+
+/*
+ * If "auto" is selected, hash some data with every available backend, the
+ * way verify does, and select the fastest. This does nothing the second
+ * time. Not thread safe, call it before hashing starts
+ */
+void hash_backend_resolve(void);
+
+/*
+ * Get the selected backend. Until something is selected, it's the builtin one
+ */
+const hash_backend_t* hash_backend_current(void);
+
+/*
+ * The rest works with the selected backend
+ */
+hash_ctx_t* hash_ctx_new(void);
+void hash_ctx_free(hash_ctx_t* ctx);
+int hash_init(hash_ctx_t* ctx);
+int hash_update(hash_ctx_t* ctx, const void* data, size_t len);
+int hash_final(hash_ctx_t* ctx, unsigned char digest[HASH_SHA1_LEN]);
+
+/*
+ * Return 1 if the backend can hash from a file descriptor with hash_update_fd
+ */
+int hash_can_update_fd(void);
+int hash_update_fd(hash_ctx_t* ctx, int fd, off_t offset, size_t len);
+
+/*
+ * How many buffers should be given to hash_batch() at once
+ */
+int hash_lanes(void);
+
+/*
+ * Hash 'n' buffers of 'len' bytes each, 1 <= n <= hash_lanes()
+ * Returns 0 on success, -1 on error
+ */
+int hash_batch(hash_ctx_t* ctx, const unsigned char* const data[], size_t len, \
+        unsigned char digests[][HASH_SHA1_LEN], int n);
+
+/*
+ * Hash a single buffer with a temporary context
+ * Returns 0 on success, -1 on error
+ */
+int hash_oneshot(const void* data, size_t len, unsigned char digest[HASH_SHA1_LEN]);
+
+#endif
@@ -0,0 +1,197 @@
+#ifdef HASH_AF_ALG
+#define _GNU_SOURCE
+#include "hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+/*
+ * Hashing in the kernel with an AF_ALG socket. With update_fd the file
+ * pages are spliced through a pipe into the socket, so the data is never
+ * copied into userspace.
+ */
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+/* Try to make the pipe this large, so there are fewer splice calls */
+#define AF_ALG_PIPE_SIZE (1024 * 1024)
+
+typedef struct {
+    /* The bound transformation socket, and the accepted one to hash with */
+    int tfm_fd, op_fd;
+    int pipe_fd[2];
+    int pipe_size;
+    /* If data was sent, but the digest wasn't read yet */
+    int pending;
+} af_alg_ctx_t;
+
+static int af_alg_bind(void) {
+    struct sockaddr_alg sa = {
+        .salg_family = AF_ALG,
+        .salg_type = "hash",
+        .salg_name = "sha1",
+    };
+
+    int fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int af_alg_is_available(void) {
+    int fd = af_alg_bind();
+    if (fd == -1)
+        return 0;
+    close(fd);
+    return 1;
+}
+
+static int af_alg_pipe_open(af_alg_ctx_t* ctx) {
+    if (pipe2(ctx->pipe_fd, O_CLOEXEC) == -1)
+        return -1;
+    ctx->pipe_size = fcntl(ctx->pipe_fd[1], F_SETPIPE_SZ, AF_ALG_PIPE_SIZE);
+    if (ctx->pipe_size == -1)
+        ctx->pipe_size = fcntl(ctx->pipe_fd[1], F_GETPIPE_SZ);
+    if (ctx->pipe_size <= 0)
+        ctx->pipe_size = 64 * 1024;
+    return 0;
+}
+
+static void af_alg_pipe_close(af_alg_ctx_t* ctx) {
+    close(ctx->pipe_fd[0]);
+    close(ctx->pipe_fd[1]);
+}
+
+static hash_ctx_t* af_alg_ctx_new(void) {
+    af_alg_ctx_t* ctx = calloc(1, sizeof(af_alg_ctx_t));
+    if (!ctx)
+        return NULL;
+
+    ctx->tfm_fd = af_alg_bind();
+    if (ctx->tfm_fd == -1)
+        goto error;
+    ctx->op_fd = accept4(ctx->tfm_fd, NULL, 0, SOCK_CLOEXEC);
+    if (ctx->op_fd == -1)
+        goto error_tfm;
+    if (af_alg_pipe_open(ctx) == -1)
+        goto error_op;
+    return (hash_ctx_t*)ctx;
+
+error_op:
+    close(ctx->op_fd);
+error_tfm:
+    close(ctx->tfm_fd);
+error:
+    free(ctx);
+    return NULL;
+}
+
+static void af_alg_ctx_free(hash_ctx_t* hctx) {
+    af_alg_ctx_t* ctx = (af_alg_ctx_t*)hctx;
+    af_alg_pipe_close(ctx);
+    close(ctx->op_fd);
+    close(ctx->tfm_fd);
+    free(ctx);
+}
+
+static int af_alg_final(hash_ctx_t* hctx, unsigned char digest[HASH_SHA1_LEN]) {
+    af_alg_ctx_t* ctx = (af_alg_ctx_t*)hctx;
+    ssize_t n;
+
+    /* Reading the digest finishes the hash */
+    while ((n = read(ctx->op_fd, digest, HASH_SHA1_LEN)) == -1 && errno == EINTR);
+    ctx->pending = 0;
+    return (n == HASH_SHA1_LEN) ? 0 : -1;
+}
+
+static int af_alg_init(hash_ctx_t* hctx) {
+    af_alg_ctx_t* ctx = (af_alg_ctx_t*)hctx;
+
+    /* The next send starts a new hash, but only if the last one is done */
+    if (ctx->pending) {
+        unsigned char discard[HASH_SHA1_LEN];
+        return af_alg_final(hctx, discard);
+    }
+    return 0;
+}
+
+static int af_alg_update(hash_ctx_t* hctx, const void* data, size_t len) {
+    af_alg_ctx_t* ctx = (af_alg_ctx_t*)hctx;
+    const char* p = data;
+
+    ctx->pending = 1;
+    while (len > 0) {
+        ssize_t n = send(ctx->op_fd, p, len, MSG_MORE);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int af_alg_update_fd(hash_ctx_t* hctx, int fd, off_t offset, size_t len) {
+    af_alg_ctx_t* ctx = (af_alg_ctx_t*)hctx;
+    loff_t off = offset;
+
+    ctx->pending = 1;
+    while (len > 0) {
+        size_t chunk = (len < (size_t)ctx->pipe_size) ? len : (size_t)ctx->pipe_size;
+        ssize_t in = splice(fd, &off, ctx->pipe_fd[1], NULL, chunk, \
+                SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in == -1 && errno == EINTR)
+            continue;
+        if (in <= 0) {
+            if (in == 0)
+                errno = EIO;
+            goto error;
+        }
+        len -= in;
+
+        while (in > 0) {
+            ssize_t out = splice(ctx->pipe_fd[0], NULL, ctx->op_fd, NULL, in, \
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out == -1) {
+                if (errno == EINTR)
+                    continue;
+                goto error;
+            }
+            in -= out;
+        }
+    }
+    return 0;
+
+error:
+    /* Data may be stuck in the pipe, don't let it go into the next hash */
+    af_alg_pipe_close(ctx);
+    if (af_alg_pipe_open(ctx) == -1)
+        ctx->pipe_fd[0] = ctx->pipe_fd[1] = -1;
+    return -1;
+}
+
+const hash_backend_t hash_backend_af_alg = {
+    .name = "af_alg",
+    .is_available = af_alg_is_available,
+    .ctx_new = af_alg_ctx_new,
+    .ctx_free = af_alg_ctx_free,
+    .init = af_alg_init,
+    .update = af_alg_update,
+    .update_fd = af_alg_update_fd,
+    .final = af_alg_final,
+    .lanes = NULL,
+    .batch = NULL,
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifdef HASH_OPENSSL
+#include "hash.h"
+#include <stdlib.h>
+
+#include <openssl/evp.h>
+
+/* Hashing with libcrypto's EVP interface */
+
+typedef struct {
+    EVP_MD_CTX* md;
+} openssl_ctx_t;
+
+static int openssl_is_available(void) {
+    return EVP_sha1() != NULL;
+}
+
+static hash_ctx_t* openssl_ctx_new(void) {
+    openssl_ctx_t* ctx = malloc(sizeof(openssl_ctx_t));
+    if (!ctx)
+        return NULL;
+    ctx->md = EVP_MD_CTX_new();
+    if (!ctx->md) {
+        free(ctx);
+        return NULL;
+    }
+    return (hash_ctx_t*)ctx;
+}
+
+static void openssl_ctx_free(hash_ctx_t* ctx) {
+    EVP_MD_CTX_free(((openssl_ctx_t*)ctx)->md);
+    free(ctx);
+}
+
+static int openssl_init(hash_ctx_t* ctx) {
+    return (EVP_DigestInit_ex(((openssl_ctx_t*)ctx)->md, EVP_sha1(), NULL) == 1) ? 0 : -1;
+}
+
+static int openssl_update(hash_ctx_t* ctx, const void* data, size_t len) {
+    return (EVP_DigestUpdate(((openssl_ctx_t*)ctx)->md, data, len) == 1) ? 0 : -1;
+}
+
+static int openssl_final(hash_ctx_t* ctx, unsigned char digest[HASH_SHA1_LEN]) {
+    return (EVP_DigestFinal_ex(((openssl_ctx_t*)ctx)->md, digest, NULL) == 1) ? 0 : -1;
+}
+
+const hash_backend_t hash_backend_openssl = {
+    .name = "openssl",
+    .is_available = openssl_is_available,
+    .ctx_new = openssl_ctx_new,
+    .ctx_free = openssl_ctx_free,
+    .init = openssl_init,
+    .update = openssl_update,
+    .update_fd = NULL,
+    .final = openssl_final,
+    .lanes = NULL,
+    .batch = NULL,
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "verify.h"
 #include "showinfo.h"
 #include "opts.h"
+#include "hash.h"
 
 #ifndef PROGRAM_NAME
 #define PROGRAM_NAME "torrent-verify"
@@ -15,7 +16,7 @@
 static_assert((sizeof(long long) >= 8), "Size of long long is less than 8, cannot compile");
 
 void usage() {
-    fprintf(stderr, "Usage: " PROGRAM_NAME " [-h | -i | -s | -f CHAR] [-n] [-v data_path] [--] .torrent_file...\n");
+    fprintf(stderr, "Usage: " PROGRAM_NAME " [-h | -i | -s | -f CHAR] [-n] [-v data_path] [--hash-backend=NAME] [--io=ENGINE] [--queue-depth=N] [--direct] [--cache=POLICY] [--ionice=CLASS] [--max-read-rate=RATE] [--max-cpu=PERCENT] [--full] [--bitfield=FILE] [--partial] [--checkpoint=FILE] [--skip-verified] [--recheck] [--only=GLOB] [--only-index=N] [--sample=PERCENT] [--edges] [--seed=N] [--max-torrent-size=SIZE] [--] .torrent_file...\n");
     exit(EXIT_FAILURE);
 }
 
@@ -28,10 +29,112 @@ void help() {
 "   -h        print this help text\n"
 "   -i        show info about the torrent file\n"
 "   -v PATH   verify the torrent file, pass in the path of the files\n"
+"             With -v -, the data is read from stdin: the files one after\n"
+"             the other, without the pad files. It's hashed as it comes,\n"
+"             only one torrent can be verified like this, and --bitfield,\n"
+"             --partial, --full, --checkpoint, --skip-verified, --recheck,\n"
+"             --only, --only-index, --sample and --edges can't be used\n"
+"             with it\n"
 "   -s        don't write any output\n"
 "   -n        Don't use torrent name as a folder when verifying\n"
 "   -f CHAR   Show info from the .torrent file, as an input for a script\n"
 "             Valid CHARs are: i - Info hash\n"
+"   --hash-backend=NAME\n"
+"             Hash with this backend, or with 'auto' use the fastest one\n"
+"             Compiled in backends are: builtin"
+#ifdef HASH_OPENSSL
+" openssl"
+#endif
+#ifdef HASH_AF_ALG
+" af_alg"
+#endif
+"\n"
+"             The default is: " HASH_BACKEND_DEFAULT "\n"
+"   --io=ENGINE\n"
+"             How to read the data: stdio, mmap to hash straight from the\n"
+"             mapped files, pread to let every thread read its own pieces,\n"
+"             with readers for every disk at the same time"
+#ifdef IO_URING
+",\n"
+"             or uring to keep many reads in flight.\n"
+"             The default is pread with more than one CPU or disk, otherwise\n"
+"             uring, or stdio if it's not available\n"
+"   --queue-depth=N\n"
+"             Pieces to keep in flight with uring, the default is 32\n"
+#else
+"\n"
+"             The default is pread with more than one CPU or disk, otherwise\n"
+"             stdio\n"
+#endif
+"   --direct  Read with O_DIRECT, so the data doesn't go through the page\n"
+"             cache. This overrides --io\n"
+"   --cache=POLICY\n"
+"             What to do with the page cache after the data is hashed:\n"
+"             keep (default), drop, or drop-if-cold to only drop the\n"
+"             pages that weren't cached before\n"
+"   --ionice=CLASS\n"
+"             Read with this io priority: idle, or best-effort[:LEVEL]\n"
+"             where LEVEL is 0 (highest) to 7 (lowest, the default)\n"
+"   --max-read-rate=RATE\n"
+"             Read at most this many bytes per second, with an optional\n"
+"             K, M or G suffix\n"
+"   --max-cpu=PERCENT\n"
+"             Use at most this much CPU time, in percent of one CPU\n"
+"   --full    Check every piece, instead of stopping at the first bad one,\n"
+"             and list the bad pieces and the bytes of the files they are\n"
+"             in. It reads with pread, --io and --direct are ignored.\n"
+"             A hybrid torrent is verified with its v1 pieces then, a v2\n"
+"             only one can't be verified with it, or with --bitfield\n"
+"   --bitfield=FILE\n"
+"             With --full, write the bad pieces to FILE: a bit for every\n"
+"             piece, from the highest bit of the first byte, 1 if it's bad,\n"
+"             or can't be verified. Only one torrent can be verified with it\n"
+"   --partial Like --full, but the files that are missing are just data\n"
+"             that's not there yet. The pieces that are all in the files\n"
+"             that are there are verified, the rest can't be. It fails only\n"
+"             if there is a bad piece. Like --full, a hybrid torrent is\n"
+"             verified with its v1 pieces, a v2 only one can't be\n"
+"   --checkpoint=FILE\n"
+"             Save how far verifying got to FILE every few seconds, and if\n"
+"             it's there, go on from it, as long as the files are the same:\n"
+"             the size, the inode and the modification time. It's removed\n"
+"             when verifying is done. It reads with pread, like --full, and\n"
+"             only one torrent can be verified with it. A hybrid torrent\n"
+"             is verified with its v1 pieces, a v2 only one can't be\n"
+"   --skip-verified\n"
+"             Remember the files that are verified, in\n"
+"             $XDG_CACHE_HOME/torrent-verify, and skip the pieces that are\n"
+"             all in files that didn't change since: the size, the inode\n"
+"             and the modification time are the same. Hardlinks of a file\n"
+"             are the same file. It reads with pread, like --full. A hybrid\n"
+"             torrent is verified with its v1 pieces then, a v2 only one\n"
+"             is verified fully\n"
+"   --recheck Like --skip-verified, but verify everything, and remember\n"
+"             what's verified again\n"
+"   --only=GLOB\n"
+"             Only verify the files with a path in the torrent that matches\n"
+"             GLOB, * matches / too. Only the pieces they are in are read,\n"
+"             from the files next to them only what's in those pieces.\n"
+"             v1 torrents are read with pread then, like with --full\n"
+"   --only-index=N\n"
+"             Only verify the Nth file, from 0, it's the number before it\n"
+"             in the progress minus one. With --only too, the files that\n"
+"             either one selects are verified\n"
+"   --sample=PERCENT\n"
+"             Only verify this many percent of the pieces, picked at random.\n"
+"             It tells how much was verified, and how many of the pieces\n"
+"             can still be bad, with 95%% confidence. Only for v1 torrents,\n"
+"             they are read with pread then, like with --full\n"
+"   --edges   Verify the first and the last piece of every file, a file\n"
+"             that's cut short, or in the wrong place fails there. With\n"
+"             --sample, these are verified too\n"
+"   --seed=N  Pick the pieces of --sample with this seed, the same seed\n"
+"             picks the same pieces. By default it's random, and it's\n"
+"             printed\n"
+"   --max-torrent-size=SIZE\n"
+"             Don't load a .torrent file that's bigger than SIZE bytes, with\n"
+"             an optional K, M or G suffix. The default is 128M\n"
+
 "\n"
 "EXIT CODE\n"
 "   If no error, exit code is 0. In verify mode exit code is 0 if it's\n"
@@ -45,6 +148,9 @@ BUILD_HASH " (" BUILD_DATE ")\n"
 #ifdef HTTP_TORRENT
 "HTTP Torrent support\n"
 #endif
+#ifdef IO_URING
+"io_uring support\n"
+#endif
 #endif
 );
     exit(EXIT_SUCCESS);
@@ -57,6 +163,11 @@ int main(int argc, char** argv) {
     if (opt_help)
         help();
 
+    if (hash_backend_select(opt_hash_backend) == -1) {
+        fprintf(stderr, "Hash backend '%s' is not available\n", opt_hash_backend);
+        usage();
+    }
+
     if (optind >= argc) {
         fprintf(stderr, "Provide at least one torrent file"
 #ifdef HTTP_TORRENT
@@ -65,7 +176,29 @@ int main(int argc, char** argv) {
                         "\n");
         usage();
     }
-    
+    if ((opt_bitfield || opt_checkpoint) && argc - optind > 1) {
+        fprintf(stderr, "--%s can be used with one torrent only\n", \
+                (opt_bitfield) ? "bitfield" : "checkpoint");
+        usage();
+    }
+
+    if (opt_data_path && strcmp(opt_data_path, "-") == 0) {
+        /* These need the files, to read the pieces on their own */
+        const char* needs_files = (opt_bitfield) ? "bitfield" : (opt_partial) ? "partial" : \
+                                  (opt_full) ? "full" : (opt_checkpoint) ? "checkpoint" : \
+                                  (opt_recheck) ? "recheck" : (opt_skip_verified) ? "skip-verified" : \
+                                  (opt_only) ? "only" : (opt_only_index >= 0) ? "only-index" : \
+                                  (opt_sample > 0) ? "sample" : (opt_edges) ? "edges" : NULL;
+        if (needs_files) {
+            fprintf(stderr, "--%s can't be used with -v -\n", needs_files);
+            usage();
+        }
+        if (argc - optind > 1) {
+            fprintf(stderr, "-v - can be used with one torrent only\n");
+            usage();
+        }
+    }
+
     int exit_code = EXIT_SUCCESS;
     for (int i = optind; i < argc; i++) {
         metainfo_t m;
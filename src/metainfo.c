@@ -4,86 +4,132 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include "sha1.h"
+#include "hash.h"
 #include "metainfo_http.h"
+#include "opts.h"
+#include "sha256.h"
 
 
 
-/* 
- * Read the file in memory, and return the pointer to it (which needs to be
- * freed) in out_contents and the size in out_size. If the file is too big,
- * fail. Returns 0 on success and an errno on fail.
+/*
+ * Read what's left of 'fd' in memory, for the files that can't be mapped,
+ * like pipes. The pointer (which needs to be freed) is returned in
+ * out_contents and the size in out_size. If it's too big, fail.
+ * Returns 0 on success and an errno on fail.
  */
-static int metainfo_read_file(const char* path, char** out_contents, int* out_size) {
-    int ret = 0;
-    FILE* f = NULL;
-    long size = 0;
-    char* contents = NULL, *curr_contents = NULL;
-    size_t read;
+static int metainfo_read_fd(int fd, char** out_contents, int* out_size) {
+    char* contents = NULL;
+    long size = 0, alloced = 0;
+
+    for (;;) {
+        if (size == alloced) {
+            /* One more byte than the limit, to tell if it's over it */
+            alloced = alloced ? alloced * 2 : 16384;
+            if (alloced > opt_max_torrent_size + 1)
+                alloced = opt_max_torrent_size + 1;
+
+            char* n_contents = realloc(contents, alloced);
+            if (!n_contents) {
+                free(contents);
+                return ENOMEM;
+            }
+            contents = n_contents;
+        }
 
-    f = fopen(path, "rb");
-    if (!f) {
-        ret = errno;
-        goto end;
+        ssize_t r = read(fd, contents + size, alloced - size);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r == -1) {
+            int ret = errno;
+            free(contents);
+            return ret;
+        }
+        if (r == 0)
+            break;
+
+        size += r;
+        if (size > opt_max_torrent_size) {
+            free(contents);
+            return EFBIG;
+        }
     }
-    
-    /* Get the file size, and bail if it's too large */
-    if (fseek(f, 0, SEEK_END) == -1) {
+
+    *out_size = size;
+    *out_contents = contents;
+    return 0;
+}
+
+/*
+ * Map the file read-only, and return the pointer to it in out_contents and
+ * the size in out_size. The parser works in place, so the pages are only
+ * read when something looks at them. Files that can't be mapped are read
+ * in memory instead, out_mapped tells which one it is. If the file is too
+ * big, fail. Returns 0 on success and an errno on fail.
+ */
+static int metainfo_read_file(const char* path, char** out_contents, int* out_size, int* out_mapped) {
+    int ret = 0;
+    struct stat st;
+    void* contents;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+
+    if (fstat(fd, &st) == -1) {
         ret = errno;
         goto end;
     }
 
-    size = ftell(f);
-    if (size > MAX_TORRENT_SIZE) {
-        ret = EFBIG;
+    /* Pipes, and empty files, mmap doesn't take those */
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        *out_mapped = 0;
+        ret = metainfo_read_fd(fd, out_contents, out_size);
         goto end;
     }
-    rewind(f);
 
-    contents = curr_contents = malloc(size);
-    if (!contents) {
-        ret = ENOMEM;
+    if (st.st_size > opt_max_torrent_size) {
+        ret = EFBIG;
         goto end;
     }
 
-    /* Read it in */
-    while ((read = fread(curr_contents, 1, \
-                    size - (curr_contents - contents), f)) > 0) {
-        curr_contents += read;
-    }
-    if (ferror(f)) {
+    contents = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (contents == MAP_FAILED) {
         ret = errno;
-        free(curr_contents);
-        curr_contents = NULL;
         goto end;
     }
 
-end:
-    if (f)
-        fclose(f);
-
-    *out_size = size;
+    *out_size = st.st_size;
     *out_contents = contents;
+    *out_mapped = 1;
+
+end:
+    close(fd);
     return ret;
 }
 
 
 /* 
- * Read/download the file in memory, and return the pointer to it (which needs to be
- * freed) in out_contents and the size in out_size. If the file is too big,
- * fail. Returns 0 on success and an errno on fail.
+ * Map/download the file, and return the pointer to it in out_contents and
+ * the size in out_size. out_mapped is 1 if it needs to be unmapped, 0 if
+ * freed. If the file is too big, fail. Returns 0 on success and an errno
+ * on fail.
  */
-static int metainfo_read(const char* path, char** out_contents, int* out_size) {
+static int metainfo_read(const char* path, char** out_contents, int* out_size, int* out_mapped) {
     if (strncmp(path, "http", 4) == 0) {
 #ifndef HTTP_TORRENT
         return ENOPROTOOPT;
 #else
+        *out_mapped = 0;
         return metainfo_read_http(path, out_contents, out_size);
 #endif
     }
 
-    return metainfo_read_file(path, out_contents, out_size);
+    return metainfo_read_file(path, out_contents, out_size, out_mapped);
 }
 
 static int len_strcmp(const char* s1, int s1_len, const char* s2, int s2_len) {
@@ -108,15 +154,12 @@ static int metainfo_hash_info(metainfo_t* metai, bencode_t* info) {
     /* Almost as if this function was made for this, lol */
     bencode_dict_get_start_and_len(info, &info_start, &info_len);
     
-    SHA1_CTX ctx;
-    SHA1Init(&ctx);
-    SHA1Update(&ctx, (const unsigned char*)info_start, info_len);
-    SHA1Final((unsigned char*)&metai->info_hash, &ctx);
-    return 0;
+    return hash_oneshot(info_start, info_len, metai->info_hash);
 }
 
 static int metainfo_parse_info(metainfo_t* metai, bencode_t* benc) {
-    
+    bencode_t info = *benc;
+
     metainfo_hash_info(metai, benc);
     while (bencode_dict_has_next(benc)) {
         const char* key;
@@ -149,11 +192,23 @@ static int metainfo_parse_info(metainfo_t* metai, bencode_t* benc) {
             read_benc_int_into(&item, &metai->is_private, 0);
         } else if (tkey("source") && ttype(string)) {
             metai->source = item;
+        } else if (tkey("meta version") && ttype(int)) {
+            read_benc_int_into(&item, &metai->meta_version, 0);
+        } else if (tkey("file tree") && ttype(dict)) {
+            metai->file_tree = item;
         } else {
             fprintf(stderr, "Unknown key in info dict: %.*s\n", klen, key);
         }
     }
 
+    /* The v2 info hash is only calculated if it's needed */
+    if (metai->meta_version == 2) {
+        const char* info_start;
+        int info_len;
+        bencode_dict_get_start_and_len(&info, &info_start, &info_len);
+        sha256(info_start, info_len, metai->info_hash_v2);
+    }
+
     return 0;
 }
 
@@ -183,6 +238,8 @@ static int metainfo_parse(metainfo_t* metai, bencode_t* benc) {
             metainfo_parse_info(metai, &item);
         } else if (tkey("comment") && ttype(string)) {
             metai->comment = item;
+        } else if (tkey("piece layers") && ttype(dict)) {
+            metai->piece_layers = item;
         } else {
             fprintf(stderr, "Unknown dict key: %.*s\n", klen, key);
         }
@@ -191,10 +248,12 @@ static int metainfo_parse(metainfo_t* metai, bencode_t* benc) {
     return ret;
 }
 
+static int metainfo_build_file_table(metainfo_t* metai);
+
 int metainfo_create(metainfo_t* metai, const char* path) {
     char* bytes = NULL;
-    int size = 0;
-    int ret = metainfo_read(path, &bytes, &size);
+    int size = 0, mapped = 0;
+    int ret = metainfo_read(path, &bytes, &size, &mapped);
     if (ret) {
         fprintf(stderr, "Metafile reading failed: %s\n", \
                 strerror(ret));
@@ -204,11 +263,12 @@ int metainfo_create(metainfo_t* metai, const char* path) {
     memset(metai, 0, sizeof(metainfo_t));
     metai->bytes = bytes;
     metai->bytes_size = size;
+    metai->bytes_mapped = mapped;
 
     bencode_t benc;
     bencode_init(&benc, bytes, size);
     
-    if (metainfo_parse(metai, &benc) == -1) {
+    if (metainfo_parse(metai, &benc) == -1 || metainfo_build_file_table(metai) == -1) {
         metainfo_destroy(metai);
         fprintf(stderr, "Can't parse metainfo file\n");
         return -1;
@@ -219,9 +279,15 @@ int metainfo_create(metainfo_t* metai, const char* path) {
 
 void metainfo_destroy(metainfo_t* metai) {
     if (metai->bytes) {
-        free(metai->bytes);
+        if (metai->bytes_mapped)
+            munmap(metai->bytes, metai->bytes_size);
+        else
+            free(metai->bytes);
         metai->bytes = NULL;
     }
+    free(metai->file_table);
+    metai->file_table = NULL;
+    metai->file_table_count = 0;
 }
 
 const sha1sum_t* metainfo_infohash(metainfo_t* metai) {
@@ -277,7 +343,7 @@ int metainfo_piece_index(metainfo_t* metai, int index, \
     return 0;
 }
 
-int metainfo_piece_size(metainfo_t* metai) {
+long int metainfo_piece_size(metainfo_t* metai) {
     return metai->piece_length;
 }
 
@@ -290,18 +356,47 @@ int metainfo_is_multi_file(metainfo_t* metai) {
 }
 
 long int metainfo_file_count(metainfo_t* metai) {
-    if (!(metai->is_multi_file && bencode_is_list(&metai->files)))
-        return 0;
-    long int count = 0;
-    bencode_t iterb = metai->files;
-    while (bencode_list_get_next(&iterb, NULL) != 0)
-        count++;
-    return count;
+    return (metai->is_multi_file) ? metai->file_table_count : 0;
+}
+
+int metainfo_file_table(metainfo_t* metai, const metainfo_file_t** files) {
+    *files = metai->file_table;
+    return metai->file_table_count;
+}
+
+int metainfo_file_at(metainfo_t* metai, long int offset) {
+    int low = 0, high = metai->file_table_count;
+    /* The first file that ends after the offset */
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        const metainfo_file_t* f = &metai->file_table[mid];
+        if (f->offset + f->size <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return (low < metai->file_table_count && offset >= 0) ? low : -1;
+}
+
+/* Parse the attr string of a file, the letters that aren't known are
+ * ignored, as BEP 47 says */
+static int metainfo_attr_parse(const char* s, int len) {
+    int attr = 0;
+    for (int i = 0; i < len; i++) {
+        switch (s[i]) {
+        case 'p': attr |= METAINFO_ATTR_PAD; break;
+        case 'x': attr |= METAINFO_ATTR_EXEC; break;
+        case 'h': attr |= METAINFO_ATTR_HIDDEN; break;
+        case 'l': attr |= METAINFO_ATTR_SYMLINK; break;
+        }
+    }
+    return attr;
 }
 
 static int metainfo_file_dict2fileinfo(bencode_t* f_dict, fileinfo_t* finfo) {
-    int has_path = 0, has_size = 0;
-    while (bencode_dict_has_next(f_dict) && (!has_path || !has_size)) {
+    int has_path = 0, has_size = 0, has_target = 0;
+    finfo->attr = 0;
+    while (bencode_dict_has_next(f_dict)) {
         const char* key;
         int klen;
         bencode_t item;
@@ -313,23 +408,29 @@ static int metainfo_file_dict2fileinfo(bencode_t* f_dict, fileinfo_t* finfo) {
         } else if (tkey("path") && ttype(list)) {
             has_path = 1;
             finfo->path = item;
-        } else {
-            fprintf(stderr, "Unknown key in files dict: %*.s\n", klen, key);
+        } else if (tkey("attr") && ttype(string)) {
+            const char* attr;
+            int alen;
+            bencode_string_value(&item, &attr, &alen);
+            finfo->attr = metainfo_attr_parse(attr, alen);
+        } else if (tkey("symlink path") && ttype(list)) {
+            has_target = 1;
+            finfo->symlink_path = item;
+        } else if (!tkey("sha1") && !tkey("md5sum")) {
+            fprintf(stderr, "Unknown key in files dict: %.*s\n", klen, key);
         }
     }
+    /* A symlink without a target can't be checked, it's a plain file then */
+    if (!has_target)
+        finfo->attr &= ~METAINFO_ATTR_SYMLINK;
     return (has_path && has_size) ? 0 : -1;
 }
 
-int metainfo_file_index(metainfo_t* metai, int index, fileinfo_t* finfo) {
-    if (!(metai->is_multi_file && bencode_is_list(&metai->files)))
+int metainfo_file_index(metainfo_t* metai, int index, const metainfo_file_t** file) {
+    if (index < 0 || index >= metai->file_table_count)
         return -1;
-    bencode_t iterb = metai->files;
-    while (index-- && bencode_list_get_next(&iterb, NULL) != 0);
-    
-    if (!bencode_is_dict(&iterb))
-        return -1;
-        
-    return metainfo_file_dict2fileinfo(&iterb, finfo);
+    *file = &metai->file_table[index];
+    return 0;
 }
 
 int metainfo_fileiter_create(const metainfo_t* metai, fileiter_t* fileiter) {
@@ -354,6 +455,7 @@ int metainfo_fileinfo(metainfo_t* metai, fileinfo_t* finfo) {
     finfo->size = metai->file_size;
     /* In the case of single files, the name is the filename */
     finfo->path = metai->name;
+    finfo->attr = 0;
     return 0;
 }
 
@@ -363,11 +465,15 @@ int metainfo_fileinfo(metainfo_t* metai, fileinfo_t* finfo) {
     #define PATH_SEP '/'
 #endif
 
-int metainfo_fileinfo_path(fileinfo_t* finfo, char* out_str) {
+/*
+ * Join a path list, or copy a single string
+ * Returns the length, or -1 if there is something else than strings in it
+ */
+static int metainfo_path_join(const bencode_t* path, char* out_str) {
     int count = 0;
 
-    if (bencode_is_list(&finfo->path)) {
-        bencode_t local_copy = finfo->path;
+    if (bencode_is_list(path)) {
+        bencode_t local_copy = *path;
         bencode_t item;
         while (bencode_list_has_next(&local_copy)) {
             /* If not in the first iter, append separator */
@@ -381,7 +487,8 @@ int metainfo_fileinfo_path(fileinfo_t* finfo, char* out_str) {
             
             int slen;
             const char* s;
-            bencode_string_value(&item, &s, &slen);
+            if (!bencode_string_value(&item, &s, &slen))
+                return -1;
 
             count += slen;
             if (out_str) {
@@ -393,7 +500,9 @@ int metainfo_fileinfo_path(fileinfo_t* finfo, char* out_str) {
         /* Single file, we shouldn't even copy here, but it's easier... */
         int slen;
         const char* s;
-        bencode_string_value(&finfo->path, &s, &slen);
+        bencode_t local_copy = *path;
+        if (!bencode_string_value(&local_copy, &s, &slen))
+            return -1;
         if (out_str) {
             memcpy(out_str, s, slen);
         }
@@ -403,10 +512,276 @@ int metainfo_fileinfo_path(fileinfo_t* finfo, char* out_str) {
     return count;
 }
 
+int metainfo_fileinfo_path(fileinfo_t* finfo, char* out_str) {
+    return metainfo_path_join(&finfo->path, out_str);
+}
+
 long int metainfo_fileinfo_size(fileinfo_t* finfo) {
     return finfo->size;
 }
 
+/*
+ * Make room for 'more' bytes in a buffer that grows by doubling
+ * Returns 0 on success, -1 if it can't be allocated
+ */
+static int metainfo_grow(void** buf, size_t* alloc, size_t used, size_t more) {
+    if (used + more <= *alloc)
+        return 0;
+    size_t n = (*alloc) ? *alloc : 4096;
+    while (n < used + more)
+        n *= 2;
+    void* b = realloc(*buf, n);
+    if (!b)
+        return -1;
+    *buf = b;
+    *alloc = n;
+    return 0;
+}
+
+/*
+ * Build the file table, so the files don't have to be parsed again every
+ * time they are needed. The files are parsed once, into buffers that
+ * grow, then the table and the paths are copied into one allocation
+ * Returns 0 on success, -1 on error
+ */
+static int metainfo_build_file_table(metainfo_t* metai) {
+    bencode_t list = metai->files;
+    fileinfo_t finfo;
+    metainfo_file_t* table = NULL;
+    char* strings = NULL;
+    size_t table_alloc = 0, strings_alloc = 0, strings_len = 0;
+    long int offset = 0;
+    int count = 0, result = -1;
+
+    /* A v2 only torrent has the file tree, and a single file needs a name */
+    if ((metainfo_is_v2(metai) && !metai->pieces) || \
+            (!metai->is_multi_file && !metai->name.start))
+        return 0;
+
+    for (;; count++) {
+        if (metai->is_multi_file) {
+            if (!bencode_list_has_next(&list))
+                break;
+            bencode_t f_dict;
+            bencode_list_get_next(&list, &f_dict);
+            if (!bencode_is_dict(&f_dict) || metainfo_file_dict2fileinfo(&f_dict, &finfo) == -1) {
+                fprintf(stderr, "Invalid file in the files list at: %d\n", count);
+                goto end;
+            }
+        } else if (count == 0) {
+            metainfo_fileinfo(metai, &finfo);
+        } else {
+            break;
+        }
+
+        int path_len = metainfo_path_join(&finfo.path, NULL);
+        int target_len = metainfo_fileinfo_symlink_path(&finfo, NULL);
+        if (path_len == -1 || (finfo.attr & METAINFO_ATTR_SYMLINK && target_len == -1) || \
+                finfo.size < 0) {
+            fprintf(stderr, "Invalid file in the files list at: %d\n", count);
+            goto end;
+        }
+        size_t more = path_len + 1 + ((target_len >= 0) ? target_len + 1 : 0);
+        if (metainfo_grow((void**)&table, &table_alloc, count * sizeof(metainfo_file_t), \
+                    sizeof(metainfo_file_t)) == -1 || \
+                metainfo_grow((void**)&strings, &strings_alloc, strings_len, more) == -1) {
+            fprintf(stderr, "Can't allocate the file table\n");
+            goto end;
+        }
+
+        /* The pointers are set when the paths are in their place */
+        metainfo_file_t* f = &table[count];
+        f->path_len = path_len;
+        metainfo_path_join(&finfo.path, strings + strings_len);
+        strings[strings_len + path_len] = '\0';
+        f->symlink_path_len = target_len;
+        if (target_len >= 0) {
+            metainfo_fileinfo_symlink_path(&finfo, strings + strings_len + path_len + 1);
+            strings[strings_len + more - 1] = '\0';
+        }
+        strings_len += more;
+        f->size = finfo.size;
+        f->offset = offset;
+        f->attr = finfo.attr;
+        offset += finfo.size;
+    }
+    if (count == 0) {
+        result = 0;
+        goto end;
+    }
+
+    metai->file_table = malloc(count * sizeof(metainfo_file_t) + strings_len);
+    if (!metai->file_table) {
+        fprintf(stderr, "Can't allocate the file table\n");
+        goto end;
+    }
+    memcpy(metai->file_table, table, count * sizeof(metainfo_file_t));
+    char* curr = memcpy(metai->file_table + count, strings, strings_len);
+    for (int i = 0; i < count; i++) {
+        metainfo_file_t* f = &metai->file_table[i];
+        f->path = curr;
+        curr += f->path_len + 1;
+        f->symlink_path = NULL;
+        if (f->symlink_path_len >= 0) {
+            f->symlink_path = curr;
+            curr += f->symlink_path_len + 1;
+        } else {
+            f->symlink_path_len = 0;
+        }
+    }
+    metai->file_table_count = count;
+    result = 0;
+
+end:
+    free(table);
+    free(strings);
+    return result;
+}
+
+int metainfo_fileinfo_attr(fileinfo_t* finfo) {
+    return finfo->attr;
+}
+
+int metainfo_fileinfo_symlink_path(fileinfo_t* finfo, char* out_str) {
+    if (!(finfo->attr & METAINFO_ATTR_SYMLINK))
+        return -1;
+    return metainfo_path_join(&finfo->symlink_path, out_str);
+}
+
+int metainfo_is_v2(metainfo_t* metai) {
+    return metai->meta_version == 2 && metai->file_tree.start != NULL;
+}
+
+const sha256sum_t* metainfo_infohash_v2(metainfo_t* metai) {
+    if (metai->meta_version != 2)
+        return NULL;
+    return &metai->info_hash_v2;
+}
+
+int metainfo_filetree_create(const metainfo_t* metai, filetree_iter_t* iter) {
+    if (metai->meta_version != 2 || !bencode_is_dict(&metai->file_tree))
+        return -1;
+    iter->dirs[0] = metai->file_tree;
+    iter->depth = 1;
+    return 0;
+}
+
+/* Parse the dict under the "" key, the file itself */
+static int metainfo_filetree_dict2info(bencode_t* f_dict, filetree_info_t* finfo) {
+    int has_size = 0;
+    finfo->pieces_root = NULL;
+    while (bencode_dict_has_next(f_dict)) {
+        const char* key;
+        int klen;
+        bencode_t item;
+        bencode_dict_get_next(f_dict, &item, &key, &klen);
+
+        if (tkey("length") && ttype(int)) {
+            has_size = 1;
+            bencode_int_value(&item, &finfo->size);
+        } else if (tkey("pieces root") && ttype(string)) {
+            const char* root;
+            int rlen;
+            bencode_string_value(&item, &root, &rlen);
+            if (rlen == sizeof(sha256sum_t))
+                finfo->pieces_root = (const sha256sum_t*)root;
+        } else if (!tkey("attr")) {
+            fprintf(stderr, "Unknown key in file tree dict: %.*s\n", klen, key);
+        }
+    }
+    if (!has_size) {
+        fprintf(stderr, "File tree entry without a length\n");
+        return -1;
+    }
+    /* Only empty files can go without a root */
+    if (finfo->size > 0 && !finfo->pieces_root) {
+        fprintf(stderr, "File tree entry without a valid pieces root\n");
+        return -1;
+    }
+    return 0;
+}
+
+int metainfo_filetree_next(filetree_iter_t* iter, filetree_info_t* finfo) {
+    while (iter->depth > 0) {
+        bencode_t* dir = &iter->dirs[iter->depth - 1];
+        if (!bencode_dict_has_next(dir)) {
+            iter->depth--;
+            continue;
+        }
+
+        const char* key;
+        int klen;
+        bencode_t item;
+        bencode_dict_get_next(dir, &item, &key, &klen);
+        if (!ttype(dict))
+            continue;
+
+        /* An empty key marks that the path so far is a file */
+        if (klen == 0) {
+            if (iter->depth == 1)
+                continue;
+            finfo->path = iter->path;
+            finfo->path_len = iter->depth - 1;
+            return metainfo_filetree_dict2info(&item, finfo);
+        }
+
+        if (iter->depth == METAINFO_FILETREE_MAX_DEPTH) {
+            fprintf(stderr, "File tree is too deep at: %.*s\n", klen, key);
+            return -1;
+        }
+        iter->path[iter->depth - 1].str = key;
+        iter->path[iter->depth - 1].len = klen;
+        iter->dirs[iter->depth++] = item;
+    }
+    return 1;
+}
+
+int metainfo_filetree_path(const filetree_info_t* finfo, char* out_str) {
+    int count = 0;
+    for (int i = 0; i < finfo->path_len; i++) {
+        if (i > 0) {
+            if (out_str)
+                *out_str++ = PATH_SEP;
+            count++;
+        }
+        if (out_str) {
+            memcpy(out_str, finfo->path[i].str, finfo->path[i].len);
+            out_str += finfo->path[i].len;
+        }
+        count += finfo->path[i].len;
+    }
+    return count;
+}
+
+int metainfo_piece_layer(metainfo_t* metai, const sha256sum_t* pieces_root, \
+                         const sha256sum_t** layer, int* count) {
+    if (!bencode_is_dict(&metai->piece_layers))
+        return -1;
+
+    bencode_t layers = metai->piece_layers;
+    while (bencode_dict_has_next(&layers)) {
+        const char* key;
+        int klen;
+        bencode_t item;
+        bencode_dict_get_next(&layers, &item, &key, &klen);
+
+        if (klen != sizeof(sha256sum_t) || memcmp(key, pieces_root, klen) != 0)
+            continue;
+        if (!ttype(string))
+            return -1;
+
+        const char* str;
+        int slen;
+        bencode_string_value(&item, &str, &slen);
+        if (slen % sizeof(sha256sum_t) != 0)
+            return -1;
+        *layer = (const sha256sum_t*)str;
+        *count = slen / sizeof(sha256sum_t);
+        return 0;
+    }
+    return -1;
+}
+
 #undef tkey
 #undef ttype
 
@@ -2,9 +2,6 @@
 #define METAFILE_H
 #include <bencode.h>
 
-/* 128 MiB */
-#define MAX_TORRENT_SIZE 128*1024*1024
-
 /* This file will parse the .torrent file and make accessor functions */
 
 typedef struct {
@@ -12,15 +9,63 @@ typedef struct {
     int len;
 } lenstr_t;
 
+/* File attributes (BEP 47) */
+/* Padding, it's all zeros and isn't on the disk */
+#define METAINFO_ATTR_PAD 1
+#define METAINFO_ATTR_EXEC 2
+#define METAINFO_ATTR_HIDDEN 4
+/* A symlink, it has no data, the target is in symlink_path */
+#define METAINFO_ATTR_SYMLINK 8
+
 typedef struct {
     bencode_t path;
     long int size;
+    /* METAINFO_ATTR_* */
+    int attr;
+    /* Relative to the torrent folder, if it's a symlink */
+    bencode_t symlink_path;
 } fileinfo_t;
 
 typedef struct {
     bencode_t filelist;
 } fileiter_t;
 
+/* A file of a v1 torrent, in the file table */
+typedef struct {
+    /* The path in the torrent, joined with separators, 0 terminated */
+    const char* path;
+    int path_len;
+    /* Same for the target, if it's a symlink, or NULL */
+    const char* symlink_path;
+    int symlink_path_len;
+    long int size;
+    /* Where the data of the file starts in the torrent */
+    long int offset;
+    /* METAINFO_ATTR_* */
+    int attr;
+} metainfo_file_t;
+
+/* The deepest directory nesting accepted in a v2 file tree */
+#define METAINFO_FILETREE_MAX_DEPTH 64
+
+typedef unsigned char sha256sum_t[32];
+
+/* A file in a v2 (BEP 52) file tree */
+typedef struct {
+    long int size;
+    /* NULL if the file is empty */
+    const sha256sum_t* pieces_root;
+    /* Path components, these point into the iterator */
+    const lenstr_t* path;
+    int path_len;
+} filetree_info_t;
+
+typedef struct {
+    bencode_t dirs[METAINFO_FILETREE_MAX_DEPTH];
+    lenstr_t path[METAINFO_FILETREE_MAX_DEPTH];
+    int depth;
+} filetree_iter_t;
+
 typedef unsigned char sha1sum_t[20];
 /*
 typedef struct __attribute__((packed)) sha1sum_t {
@@ -29,8 +74,11 @@ typedef struct __attribute__((packed)) sha1sum_t {
 */
 
 typedef struct {
+    /* The .torrent file, mapped read-only if bytes_mapped, otherwise
+     * malloc-ed. Everything that's parsed points into it */
     char* bytes;
     int bytes_size;
+    int bytes_mapped;
     
     sha1sum_t info_hash;
     const sha1sum_t* pieces;
@@ -45,6 +93,16 @@ typedef struct {
         long int file_size;
         bencode_t files;
     };
+
+    /* BitTorrent v2, 0 if it's a v1 only torrent */
+    long int meta_version;
+    sha256sum_t info_hash_v2;
+    bencode_t file_tree, piece_layers;
+
+    /* The files, built when it's loaded, a single file torrent has one
+     * too. The paths are in the same allocation, after the table */
+    metainfo_file_t* file_table;
+    int file_table_count;
 } metainfo_t;
 
 /*
@@ -112,7 +170,7 @@ int metainfo_piece_index(metainfo_t* metai, int index, \
 /*
  * Get the size of 1 piece
  */
-int metainfo_piece_size(metainfo_t* metai);
+long int metainfo_piece_size(metainfo_t* metai);
 
 /*
  * Return 1 if the torrent has multiple files, or 0 if has only 1 
@@ -120,15 +178,29 @@ int metainfo_piece_size(metainfo_t* metai);
 int metainfo_is_multi_file(metainfo_t* metai);
 
 /*
- * Return the number of files, if it's a multi file. This is slow 
+ * Return the number of files, if it's a multi file
  */
 long int metainfo_file_count(metainfo_t* metai);
 
 /*
- * Get the index'th file information, if it's a multi file
- * This is slow and shouldn't be used
+ * Get the file table, it has the single file too, if it's not a multi
+ * file. It's empty for a v2 only torrent.
+ * Returns the number of files in it
+ */
+int metainfo_file_table(metainfo_t* metai, const metainfo_file_t** files);
+
+/*
+ * Find the file that the byte at 'offset' of the torrent is in, that's
+ * never an empty one
+ * Returns its index in the file table, or -1 if it's past the end
  */
-int metainfo_file_index(metainfo_t* metai, int index, fileinfo_t* finfo);
+int metainfo_file_at(metainfo_t* metai, long int offset);
+
+/*
+ * Get the index'th file of the file table
+ * Returns 0 on success, -1 if there is no such file
+ */
+int metainfo_file_index(metainfo_t* metai, int index, const metainfo_file_t** file);
 
 /*
  * Create a file iterator.
@@ -162,4 +234,51 @@ int metainfo_fileinfo_path(fileinfo_t* len, char* out_str);
  */
 long int metainfo_fileinfo_size(fileinfo_t* finfo);
 
+/*
+ * Return the METAINFO_ATTR_* bits of the file
+ */
+int metainfo_fileinfo_attr(fileinfo_t* finfo);
+
+/*
+ * Same as metainfo_fileinfo_path(), for the target of a symlink
+ * Returns -1 if the file is not a symlink
+ */
+int metainfo_fileinfo_symlink_path(fileinfo_t* finfo, char* out_str);
+
+/*
+ * Return 1 if the torrent has v2 (BEP 52) metadata, this includes hybrids
+ */
+int metainfo_is_v2(metainfo_t* metai);
+
+/*
+ * Get the v2 info_hash (the SHA-256 of the info dict), or NULL if it's v1
+ */
+const sha256sum_t* metainfo_infohash_v2(metainfo_t* metai);
+
+/*
+ * Create an iterator over the v2 file tree, in the order of the dict keys.
+ * This doesn't need to be freed.
+ */
+int metainfo_filetree_create(const metainfo_t* metai, filetree_iter_t* iter);
+
+/*
+ * Get the next file in the v2 file tree
+ * Return 0 on success, 1 if there is no more files, or -1 if an entry
+ * is invalid.
+ */
+int metainfo_filetree_next(filetree_iter_t* iter, filetree_info_t* finfo);
+
+/*
+ * Same as metainfo_fileinfo_path(), for a file tree entry
+ */
+int metainfo_filetree_path(const filetree_info_t* finfo, char* out_str);
+
+/*
+ * Get the piece layer of a file by its pieces root. Files not larger than
+ * a piece don't have one.
+ * Returns -1 if there is no such layer
+ */
+int metainfo_piece_layer(metainfo_t* metai, const sha256sum_t* pieces_root, \
+                         const sha256sum_t** layer, int* count);
+
 #endif
@@ -120,7 +120,7 @@ static size_t metainfo_read_http_headercb(char *buf, size_t size, size_t n,
         errno = 0;
         len = strtoll(sep, &endp, 10);
         if (sep != endp && errno == 0) {
-            if (len > MAX_TORRENT_SIZE) {
+            if (len > opt_max_torrent_size) {
                 h_meta->err = EFBIG;
                 return 0;
             }
@@ -169,9 +169,10 @@ static size_t metainfo_read_http_writecb(char *ptr, size_t size, size_t n,
     struct http_metainfo *h_meta = (struct http_metainfo*)data;
     size_t bytes = size * n;
 
-    if (h_meta->max_size > MAX_TORRENT_SIZE) {
+    /* Stop processing if too large */
+    if (h_meta->c_size + bytes > opt_max_torrent_size) {
         h_meta->err = EFBIG;
-        goto fail; /* Stop processing if too large */
+        goto fail;
     }
 
     if (h_meta->max_size == -1) {
@@ -190,6 +191,10 @@ static size_t metainfo_read_http_writecb(char *ptr, size_t size, size_t n,
                 h_meta->max_size = 2048;
 
             h_meta->max_size *= 2;
+            /* The data fits under the limit, so the buffer doesn't need to
+             * be larger */
+            if (h_meta->max_size > opt_max_torrent_size)
+                h_meta->max_size = opt_max_torrent_size;
             free_space = h_meta->max_size - h_meta->c_size;
         }
 
@@ -202,11 +207,6 @@ static size_t metainfo_read_http_writecb(char *ptr, size_t size, size_t n,
         h_meta->data = n_data;
     }
 
-    if (h_meta->c_size + bytes > MAX_TORRENT_SIZE) {
-        h_meta->err = EFBIG;
-        goto fail;
-    }
-
     memcpy(&h_meta->data[h_meta->c_size], ptr, bytes);
     h_meta->c_size += bytes;
 
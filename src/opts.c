@@ -1,6 +1,10 @@
 #include "opts.h"
 #include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <getopt.h>
+#include <fnmatch.h>
 
 int opt_silent = 0;
 int opt_showinfo = 0;
@@ -9,12 +13,199 @@ int opt_no_use_dir = 0;
 int opt_pretty_progress = 0;
 int opt_scriptformat_info = OPT_SCRIPTFORMAT_NONE;
 char* opt_data_path = NULL;
+const char* opt_hash_backend = HASH_BACKEND_DEFAULT;
+enum OPT_IO opt_io = OPT_IO_AUTO;
+int opt_queue_depth = OPT_QUEUE_DEPTH_DEFAULT;
+int opt_direct = 0;
+enum OPT_CACHE opt_cache = OPT_CACHE_KEEP;
+enum OPT_IONICE opt_ionice = OPT_IONICE_NONE;
+int opt_ionice_level = OPT_IONICE_LEVEL_MAX;
+long int opt_max_read_rate = 0;
+int opt_max_cpu = 0;
+int opt_full = 0;
+const char* opt_bitfield = NULL;
+int opt_partial = 0;
+const char* opt_checkpoint = NULL;
+int opt_skip_verified = 0;
+int opt_recheck = 0;
+const char* opt_only = NULL;
+int opt_only_index = -1;
+double opt_sample = 0;
+int opt_edges = 0;
+long int opt_seed = -1;
+long int opt_max_torrent_size = OPT_MAX_TORRENT_SIZE_DEFAULT;
+
+static const struct option opts_long[] = {
+    { "hash-backend", required_argument, NULL, OPT_LONG_HASH_BACKEND },
+    { "io", required_argument, NULL, OPT_LONG_IO },
+    { "queue-depth", required_argument, NULL, OPT_LONG_QUEUE_DEPTH },
+    { "direct", no_argument, NULL, OPT_LONG_DIRECT },
+    { "cache", required_argument, NULL, OPT_LONG_CACHE },
+    { "ionice", required_argument, NULL, OPT_LONG_IONICE },
+    { "max-read-rate", required_argument, NULL, OPT_LONG_MAX_READ_RATE },
+    { "max-cpu", required_argument, NULL, OPT_LONG_MAX_CPU },
+    { "full", no_argument, NULL, OPT_LONG_FULL },
+    { "bitfield", required_argument, NULL, OPT_LONG_BITFIELD },
+    { "partial", no_argument, NULL, OPT_LONG_PARTIAL },
+    { "checkpoint", required_argument, NULL, OPT_LONG_CHECKPOINT },
+    { "skip-verified", no_argument, NULL, OPT_LONG_SKIP_VERIFIED },
+    { "recheck", no_argument, NULL, OPT_LONG_RECHECK },
+    { "only", required_argument, NULL, OPT_LONG_ONLY },
+    { "only-index", required_argument, NULL, OPT_LONG_ONLY_INDEX },
+    { "sample", required_argument, NULL, OPT_LONG_SAMPLE },
+    { "edges", no_argument, NULL, OPT_LONG_EDGES },
+    { "seed", required_argument, NULL, OPT_LONG_SEED },
+    { "max-torrent-size", required_argument, NULL, OPT_LONG_MAX_TORRENT_SIZE },
+    { 0 },
+};
+
+/*
+ * Parse a size, with an optional K, M or G suffix, these are powers of 1024
+ * Returns the size, or -1 if it's invalid
+ */
+static long int opts_parse_size(const char* str) {
+    char* end;
+    long int size = strtol(str, &end, 10);
+    if (end == str || size < 0)
+        return -1;
+
+    int shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (*end != '\0' || size > (LONG_MAX >> shift))
+        return -1;
+    return size << shift;
+}
 
 int opts_parse(int argc, char** argv) {
     int opt;
 
-    while ((opt = getopt(argc, argv, "pnihsv:f:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "pnihsv:f:", opts_long, NULL)) != -1) {
         switch (opt) {
+            case OPT_LONG_HASH_BACKEND:
+                opt_hash_backend = optarg;
+                break;
+            case OPT_LONG_IO:
+                if (strcmp(optarg, "stdio") == 0)
+                    opt_io = OPT_IO_STDIO;
+                else if (strcmp(optarg, "mmap") == 0)
+                    opt_io = OPT_IO_MMAP;
+                else if (strcmp(optarg, "pread") == 0)
+                    opt_io = OPT_IO_PREAD;
+#ifdef IO_URING
+                else if (strcmp(optarg, "uring") == 0)
+                    opt_io = OPT_IO_URING;
+#endif
+                else
+                    return -1;
+                break;
+            case OPT_LONG_QUEUE_DEPTH:
+                opt_queue_depth = atoi(optarg);
+                if (opt_queue_depth < 1 || opt_queue_depth > OPT_QUEUE_DEPTH_MAX)
+                    return -1;
+                break;
+            case OPT_LONG_DIRECT:
+                opt_direct = 1;
+                break;
+            case OPT_LONG_CACHE:
+                if (strcmp(optarg, "keep") == 0)
+                    opt_cache = OPT_CACHE_KEEP;
+                else if (strcmp(optarg, "drop") == 0)
+                    opt_cache = OPT_CACHE_DROP;
+                else if (strcmp(optarg, "drop-if-cold") == 0)
+                    opt_cache = OPT_CACHE_DROP_IF_COLD;
+                else
+                    return -1;
+                break;
+            case OPT_LONG_IONICE:
+                if (strcmp(optarg, "idle") == 0) {
+                    opt_ionice = OPT_IONICE_IDLE;
+                    opt_ionice_level = 0;
+                } else if (strncmp(optarg, "best-effort", 11) == 0) {
+                    opt_ionice = OPT_IONICE_BEST_EFFORT;
+                    if (optarg[11] == ':') {
+                        char* end;
+                        opt_ionice_level = strtol(optarg + 12, &end, 10);
+                        if (end == optarg + 12 || *end != '\0' || \
+                                opt_ionice_level < 0 || opt_ionice_level > OPT_IONICE_LEVEL_MAX)
+                            return -1;
+                    } else if (optarg[11] != '\0') {
+                        return -1;
+                    }
+                } else {
+                    return -1;
+                }
+                break;
+            case OPT_LONG_MAX_READ_RATE:
+                opt_max_read_rate = opts_parse_size(optarg);
+                if (opt_max_read_rate <= 0)
+                    return -1;
+                break;
+            case OPT_LONG_MAX_CPU:
+                opt_max_cpu = atoi(optarg);
+                if (opt_max_cpu <= 0)
+                    return -1;
+                break;
+            case OPT_LONG_FULL:
+                opt_full = 1;
+                break;
+            case OPT_LONG_BITFIELD:
+                opt_bitfield = optarg;
+                opt_full = 1;
+                break;
+            case OPT_LONG_PARTIAL:
+                opt_partial = 1;
+                opt_full = 1;
+                break;
+            case OPT_LONG_CHECKPOINT:
+                opt_checkpoint = optarg;
+                break;
+            case OPT_LONG_SKIP_VERIFIED:
+                opt_skip_verified = 1;
+                break;
+            case OPT_LONG_RECHECK:
+                opt_recheck = 1;
+                opt_skip_verified = 1;
+                break;
+            case OPT_LONG_ONLY:
+                opt_only = optarg;
+                break;
+            case OPT_LONG_ONLY_INDEX: {
+                char* end;
+                long int index = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || index < 0 || index > INT_MAX)
+                    return -1;
+                opt_only_index = index;
+                break;
+            }
+            case OPT_LONG_SAMPLE: {
+                char* end;
+                opt_sample = strtod(optarg, &end);
+                if (*end == '%')
+                    end++;
+                if (end == optarg || *end != '\0' || !(opt_sample > 0 && opt_sample <= 100))
+                    return -1;
+                break;
+            }
+            case OPT_LONG_EDGES:
+                opt_edges = 1;
+                break;
+            case OPT_LONG_SEED: {
+                char* end;
+                opt_seed = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || opt_seed < 0 || opt_seed == LONG_MAX)
+                    return -1;
+                break;
+            }
+            case OPT_LONG_MAX_TORRENT_SIZE:
+                /* The parser takes the size as an int */
+                opt_max_torrent_size = opts_parse_size(optarg);
+                if (opt_max_torrent_size <= 0 || opt_max_torrent_size > INT_MAX)
+                    return -1;
+                break;
             case 'i':
                 opt_showinfo = 1;
                 break;
@@ -54,3 +245,9 @@ int opts_parse(int argc, char** argv) {
     }
     return 0;
 }
+
+int opts_only_file(const char* path, int index) {
+    if (!opt_only && opt_only_index < 0)
+        return 1;
+    return (opt_only && fnmatch(opt_only, path, 0) == 0) || index == opt_only_index;
+}
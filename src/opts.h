@@ -17,6 +17,68 @@ const static opt_scriptformat_mapping_t OPT_SCRIPTFORMAT_MAPPING[] = {
 };
 #define OPT_SCRIPTFORMAT_MAPPING_LEN sizeof(OPT_SCRIPTFORMAT_MAPPING)/sizeof(OPT_SCRIPTFORMAT_MAPPING[0])
 
+/* Options that only have a long form */
+enum OPT_LONG {
+    OPT_LONG_HASH_BACKEND = 256,
+    OPT_LONG_IO,
+    OPT_LONG_QUEUE_DEPTH,
+    OPT_LONG_DIRECT,
+    OPT_LONG_CACHE,
+    OPT_LONG_IONICE,
+    OPT_LONG_MAX_READ_RATE,
+    OPT_LONG_MAX_CPU,
+    OPT_LONG_FULL,
+    OPT_LONG_BITFIELD,
+    OPT_LONG_PARTIAL,
+    OPT_LONG_CHECKPOINT,
+    OPT_LONG_SKIP_VERIFIED,
+    OPT_LONG_RECHECK,
+    OPT_LONG_ONLY,
+    OPT_LONG_ONLY_INDEX,
+    OPT_LONG_SAMPLE,
+    OPT_LONG_EDGES,
+    OPT_LONG_SEED,
+    OPT_LONG_MAX_TORRENT_SIZE,
+};
+
+/* The io scheduling class to verify with */
+enum OPT_IONICE {
+    OPT_IONICE_NONE,
+    OPT_IONICE_IDLE,
+    OPT_IONICE_BEST_EFFORT,
+};
+
+/* The lowest priority of best-effort, that's the default for it */
+#define OPT_IONICE_LEVEL_MAX 7
+
+/* What to do with the page cache after hashing */
+enum OPT_CACHE {
+    OPT_CACHE_KEEP,
+    OPT_CACHE_DROP,
+    /* Only drop what wasn't cached before */
+    OPT_CACHE_DROP_IF_COLD,
+};
+
+/* How to read the data when verifying */
+enum OPT_IO {
+    /* pread if there are threads, or io_uring if it's available, or stdio */
+    OPT_IO_AUTO,
+    OPT_IO_STDIO,
+    OPT_IO_MMAP,
+    OPT_IO_URING,
+    /* Every thread reads its own pieces */
+    OPT_IO_PREAD,
+};
+
+#define OPT_QUEUE_DEPTH_DEFAULT 32
+#define OPT_QUEUE_DEPTH_MAX 4096
+
+#define OPT_MAX_TORRENT_SIZE_DEFAULT (128 * 1024 * 1024)
+
+#ifndef HASH_BACKEND_DEFAULT
+#define HASH_BACKEND_DEFAULT "builtin"
+#endif
+
 
 extern int opt_silent;
 extern int opt_showinfo;
@@ -25,8 +87,51 @@ extern int opt_no_use_dir;
 extern int opt_pretty_progress;
 extern int opt_scriptformat_info;
 extern char* opt_data_path;
+extern const char* opt_hash_backend;
+extern enum OPT_IO opt_io;
+extern int opt_queue_depth;
+extern int opt_direct;
+extern enum OPT_CACHE opt_cache;
+extern enum OPT_IONICE opt_ionice;
+extern int opt_ionice_level;
+/* Bytes per second, 0 if there is no limit */
+extern long int opt_max_read_rate;
+/* Percent of one CPU, 0 if there is no limit */
+extern int opt_max_cpu;
+/* Check every piece, instead of stopping at the first bad one */
+extern int opt_full;
+/* Write the bad pieces of --full here, NULL if not needed */
+extern const char* opt_bitfield;
+/* Missing files are data that's not there yet, instead of an error */
+extern int opt_partial;
+/* Save the progress here, and go on from it, NULL if not needed */
+extern const char* opt_checkpoint;
+/* Remember the files that are verified, and skip them if they didn't change */
+extern int opt_skip_verified;
+/* Verify the files that were verified before too, and remember them again */
+extern int opt_recheck;
+/* Only verify the files with a path in the torrent that matches this
+ * glob, NULL for all of them */
+extern const char* opt_only;
+/* Only verify the file with this index, from 0, or -1 */
+extern int opt_only_index;
+/* Percent of the pieces to verify, picked at random, 0 for all of them */
+extern double opt_sample;
+/* Verify the first and the last piece of every file */
+extern int opt_edges;
+/* Pick the pieces of --sample with this seed, -1 for a random one */
+extern long int opt_seed;
+/* Don't load a .torrent file that's bigger than this many bytes */
+extern long int opt_max_torrent_size;
 
 /* Parse the given arguments. Return -1 if error */
 int opts_parse(int argc, char** argv);
 
+/*
+ * Is the file selected by --only or --only-index? 'path' is in the
+ * torrent, 'index' is its place in the file list
+ * Returns 1 if it is, or if there is no selection
+ */
+int opts_only_file(const char* path, int index);
+
 #endif
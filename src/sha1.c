@@ -24,6 +24,7 @@ A million repetitions of "a"
 #include <stdint.h>
 
 #include "sha1.h"
+#include "sha1_hw.h"
 
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -193,35 +194,120 @@ void SHA1Init(
 }
 
 
+/* Portable kernel, runs SHA1Transform() on every block */
+
+static void sha1_portable_blocks(
+    uint32_t state[5],
+    const unsigned char *data,
+    size_t blocks
+)
+{
+    while (blocks--)
+    {
+        SHA1Transform(state, data);
+        data += 64;
+    }
+}
+
+static int sha1_portable_supported(
+    void
+)
+{
+    return 1;
+}
+
+/* Fastest first, the portable one has to be the last */
+static const sha1_kernel_t sha1_kernel_list[] = {
+#ifdef SHA1_HW_X86
+    { .name = "sha-ni", .blocks = sha1_hw_x86_blocks, .is_supported = sha1_hw_x86_supported },
+#endif
+#ifdef SHA1_HW_ARMV8
+    { .name = "armv8-ce", .blocks = sha1_hw_armv8_blocks, .is_supported = sha1_hw_armv8_supported },
+#endif
+    { .name = "portable", .blocks = sha1_portable_blocks, .is_supported = sha1_portable_supported },
+};
+#define SHA1_KERNEL_COUNT (sizeof(sha1_kernel_list) / sizeof(sha1_kernel_list[0]))
+
+static const sha1_kernel_t *sha1_kernel = &sha1_kernel_list[SHA1_KERNEL_COUNT - 1];
+
+const sha1_kernel_t *sha1_kernels(
+    int *count
+)
+{
+    *count = SHA1_KERNEL_COUNT;
+    return sha1_kernel_list;
+}
+
+int sha1_kernel_select(
+    const char *name
+)
+{
+    for (int i = 0; i < SHA1_KERNEL_COUNT; i++)
+    {
+        const sha1_kernel_t *k = &sha1_kernel_list[i];
+        if (name && strcmp(name, k->name) != 0)
+            continue;
+        if (!k->is_supported())
+        {
+            if (name)
+                return -1;
+            continue;
+        }
+        sha1_kernel = k;
+        return 0;
+    }
+    return -1;
+}
+
+const sha1_kernel_t *sha1_kernel_current(
+    void
+)
+{
+    return sha1_kernel;
+}
+
+/* Pick the fastest kernel the cpu can run before main() */
+__attribute__((constructor))
+static void sha1_kernel_autoselect(
+    void
+)
+{
+    sha1_kernel_select(NULL);
+}
+
+
 /* Run your data through this. */
 
 void SHA1Update(
     SHA1_CTX * context,
     const unsigned char *data,
-    uint32_t len
+    size_t len
 )
 {
-    uint32_t i;
+    size_t i;
 
     uint32_t j;
 
+    /* The bit count is 64 bits, split into two words */
     j = context->count[0];
-    if ((context->count[0] += len << 3) < j)
+    if ((context->count[0] += (uint32_t)(len << 3)) < j)
         context->count[1]++;
-    context->count[1] += (len >> 29);
+    context->count[1] += (uint32_t)(len >> 29);
     j = (j >> 3) & 63;
-    if ((j + len) > 63)
+    i = 0;
+    if (j && (j + len) > 63)
     {
+        /* Complete the buffered block first */
         memcpy(&context->buffer[j], data, (i = 64 - j));
-        SHA1Transform(context->state, context->buffer);
-        for (; i + 63 < len; i += 64)
-        {
-            SHA1Transform(context->state, &data[i]);
-        }
+        sha1_kernel->blocks(context->state, context->buffer, 1);
         j = 0;
     }
-    else
-        i = 0;
+    if (j == 0 && len - i > 63)
+    {
+        /* Whole blocks are hashed in place, without copying */
+        sha1_kernel->blocks(context->state, &data[i], (len - i) / 64);
+        i += (len - i) & ~(size_t)63;
+    }
     memcpy(&context->buffer[j], &data[i], len - i);
 }
 
@@ -235,9 +321,9 @@ void SHA1Final(
 {
     unsigned i;
 
-    unsigned char finalcount[8];
+    unsigned j;
 
-    unsigned char c;
+    unsigned char finalcount[8];
 
 #if 0    /* untested "improvement" by DHR */
     /* Convert context->count to a sequence of bytes
@@ -261,14 +347,18 @@ void SHA1Final(
         finalcount[i] = (unsigned char) ((context->count[(i >= 4 ? 0 : 1)] >> ((3 - (i & 3)) * 8)) & 255);      /* Endian independent */
     }
 #endif
-    c = 0200;
-    SHA1Update(context, &c, 1);
-    while ((context->count[0] & 504) != 448)
+    /* Pad in the buffer directly, instead of feeding it byte by byte */
+    j = (context->count[0] >> 3) & 63;
+    context->buffer[j++] = 0200;
+    if (j > 56)
     {
-        c = 0000;
-        SHA1Update(context, &c, 1);
+        memset(&context->buffer[j], 0, 64 - j);
+        sha1_kernel->blocks(context->state, context->buffer, 1);
+        j = 0;
     }
-    SHA1Update(context, finalcount, 8); /* Should cause a SHA1Transform() */
+    memset(&context->buffer[j], 0, 56 - j);
+    memcpy(&context->buffer[56], finalcount, 8);
+    sha1_kernel->blocks(context->state, context->buffer, 1);
     for (i = 0; i < 20; i++)
     {
         digest[i] = (unsigned char)
@@ -285,11 +375,9 @@ void SHA1(
     int len)
 {
     SHA1_CTX ctx;
-    unsigned int ii;
 
     SHA1Init(&ctx);
-    for (ii=0; ii<len; ii+=1)
-        SHA1Update(&ctx, (const unsigned char*)str + ii, 1);
+    SHA1Update(&ctx, (const unsigned char*)str, len);
     SHA1Final((unsigned char *)hash_out, &ctx);
     hash_out[20] = '\0';
 }
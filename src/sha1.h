@@ -7,6 +7,7 @@
    100% Public Domain
  */
 
+#include <stddef.h>
 #include "stdint.h"
 
 typedef struct
@@ -28,7 +29,7 @@ void SHA1Init(
 void SHA1Update(
     SHA1_CTX * context,
     const unsigned char *data,
-    uint32_t len
+    size_t len
     );
 
 void SHA1Final(
@@ -41,4 +42,47 @@ void SHA1(
     const char *str,
     int len);
 
+/*
+ * A block kernel hashes 'blocks' consecutive 64 byte blocks into state.
+ * SHA1Update() and SHA1Final() use the selected one for every block.
+ */
+typedef void (*sha1_blocks_fn)(
+    uint32_t state[5],
+    const unsigned char *data,
+    size_t blocks
+    );
+
+typedef struct
+{
+    const char *name;
+    sha1_blocks_fn blocks;
+    /* Returns non-zero if the running cpu can use this kernel */
+    int (*is_supported)(void);
+} sha1_kernel_t;
+
+/*
+ * Get the compiled in kernels, fastest first.
+ * The last one is the portable one, which is always supported
+ */
+const sha1_kernel_t *sha1_kernels(
+    int *count
+    );
+
+/*
+ * Select the kernel named 'name', or the fastest supported one if 'name'
+ * is NULL. The fastest is selected at startup.
+ * Not thread safe, call it before hashing starts.
+ * Returns 0 on success, or -1 if there is no such, or it's not supported
+ */
+int sha1_kernel_select(
+    const char *name
+    );
+
+/*
+ * Get the currently selected kernel
+ */
+const sha1_kernel_t *sha1_kernel_current(
+    void
+    );
+
 #endif /* SHA1_H */
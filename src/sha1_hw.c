@@ -0,0 +1,160 @@
+#include "sha1_hw.h"
+
+#ifdef SHA1_HW_X86
+#include <immintrin.h>
+#include <cpuid.h>
+
+int sha1_hw_x86_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+        return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ebx & bit_SHA) != 0;
+}
+
+/*
+ * 4 rounds, and the message schedule work that can be done with this
+ * group's words: finish w[g+1], add to w[g+2] and start w[g+3].
+ * In the last few groups these compute words that are never used, which
+ * is cheaper than special casing them.
+ */
+#define SHANI_ROUNDS4(f, e_cur, e_next, m0, m1, m2, m3) \
+    e_cur = _mm_sha1nexte_epu32(e_cur, m0); \
+    e_next = abcd; \
+    m1 = _mm_sha1msg2_epu32(m1, m0); \
+    abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f); \
+    m3 = _mm_sha1msg1_epu32(m3, m0); \
+    m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha1_hw_x86_blocks(uint32_t state[5], const unsigned char* data, size_t blocks) {
+    const __m128i bswap_mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i msg0, msg1, msg2, msg3;
+
+    abcd = _mm_loadu_si128((const __m128i*)state);
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        /* Rounds 0-3 */
+        msg0 = _mm_loadu_si128((const __m128i*)(data + 0));
+        msg0 = _mm_shuffle_epi8(msg0, bswap_mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        /* Rounds 4-7 */
+        msg1 = _mm_loadu_si128((const __m128i*)(data + 16));
+        msg1 = _mm_shuffle_epi8(msg1, bswap_mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        /* Rounds 8-11 */
+        msg2 = _mm_loadu_si128((const __m128i*)(data + 32));
+        msg2 = _mm_shuffle_epi8(msg2, bswap_mask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        /* Rounds 12-79 */
+        msg3 = _mm_loadu_si128((const __m128i*)(data + 48));
+        msg3 = _mm_shuffle_epi8(msg3, bswap_mask);
+        SHANI_ROUNDS4(0, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(0, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(1, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(1, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(1, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(2, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(2, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(2, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2);
+        SHANI_ROUNDS4(3, e0, e1, msg0, msg1, msg2, msg3);
+        SHANI_ROUNDS4(3, e1, e0, msg1, msg2, msg3, msg0);
+        SHANI_ROUNDS4(3, e0, e1, msg2, msg3, msg0, msg1);
+        SHANI_ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2);
+
+        /* Add the working vars back */
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        data += 64;
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128((__m128i*)state, abcd);
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHANI_ROUNDS4
+#endif /* SHA1_HW_X86 */
+
+#ifdef SHA1_HW_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+int sha1_hw_armv8_supported(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+__attribute__((target("+crypto")))
+void sha1_hw_armv8_blocks(uint32_t state[5], const unsigned char* data, size_t blocks) {
+    static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t abcd, abcd_save, wk;
+    uint32x4_t w[4];
+    uint32_t e, e_save, e_next;
+
+    abcd = vld1q_u32(state);
+    e = state[4];
+
+    while (blocks--) {
+        abcd_save = abcd;
+        e_save = e;
+
+        for (int i = 0; i < 4; i++)
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+        /* 20 groups of 4 rounds, w[g & 3] holds the words of group g */
+        for (int g = 0; g < 20; g++) {
+            wk = vaddq_u32(w[g & 3], vdupq_n_u32(k[g / 5]));
+            e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (g < 5)
+                abcd = vsha1cq_u32(abcd, e, wk);
+            else if (g >= 10 && g < 15)
+                abcd = vsha1mq_u32(abcd, e, wk);
+            else
+                abcd = vsha1pq_u32(abcd, e, wk);
+            e = e_next;
+
+            /* Schedule the words for group g + 4 */
+            if (g < 16)
+                w[g & 3] = vsha1su1q_u32(vsha1su0q_u32(w[g & 3], \
+                            w[(g + 1) & 3], w[(g + 2) & 3]), w[(g + 3) & 3]);
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        e += e_save;
+
+        data += 64;
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e;
+}
+#endif /* SHA1_HW_ARMV8 */
@@ -0,0 +1,38 @@
+#ifndef SHA1_HW_H
+#define SHA1_HW_H
+/* SHA-1 block kernels using the cpu's SHA instructions */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_HW_X86
+
+/*
+ * Hash 'blocks' 64 byte blocks with the x86 SHA extensions (SHA-NI)
+ * Only call this if sha1_hw_x86_supported() returned non-zero
+ */
+void sha1_hw_x86_blocks(uint32_t state[5], const unsigned char* data, size_t blocks);
+
+/*
+ * Return non-zero if the cpu has SHA-NI, SSSE3 and SSE4.1
+ */
+int sha1_hw_x86_supported(void);
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#define SHA1_HW_ARMV8
+
+/*
+ * Hash 'blocks' 64 byte blocks with the ARMv8 SHA1 crypto extension
+ * Only call this if sha1_hw_armv8_supported() returned non-zero
+ */
+void sha1_hw_armv8_blocks(uint32_t state[5], const unsigned char* data, size_t blocks);
+
+/*
+ * Return non-zero if the cpu reports the SHA1 hwcap
+ */
+int sha1_hw_armv8_supported(void);
+#endif
+
+#endif
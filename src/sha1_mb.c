@@ -0,0 +1,174 @@
+#include "sha1_mb.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "sha1.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+#define MB_LANES 16
+#define MB_NAME(x) sha1_mb16_##x
+#define MB_TARGET __attribute__((target("avx512f")))
+#include "sha1_mb_lanes.h"
+#undef MB_TARGET
+#undef MB_NAME
+#undef MB_LANES
+
+#define MB_LANES 8
+#define MB_NAME(x) sha1_mb8_##x
+#define MB_TARGET __attribute__((target("avx2")))
+#include "sha1_mb_lanes.h"
+#undef MB_TARGET
+#undef MB_NAME
+#undef MB_LANES
+
+#define MB_LANES 4
+#define MB_NAME(x) sha1_mb4_##x
+#define MB_TARGET __attribute__((target("sse2")))
+#include "sha1_mb_lanes.h"
+#undef MB_TARGET
+#undef MB_NAME
+#undef MB_LANES
+
+/* The os has to save the wider registers too, not just the cpu support them */
+static int sha1_mb_xgetbv_has(unsigned int mask) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+        return 0;
+    __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & mask) == mask;
+}
+
+static int sha1_mb16_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX512F))
+        return 0;
+    /* SSE, AVX and the 3 AVX-512 states */
+    return sha1_mb_xgetbv_has(0xE6);
+}
+
+static int sha1_mb8_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2))
+        return 0;
+    return sha1_mb_xgetbv_has(0x6);
+}
+
+static int sha1_mb4_supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (edx & bit_SSE2) != 0;
+}
+
+static const sha1_mb_kernel_t sha1_mb_kernel_list[] = {
+    { .name = "avx512", .lanes = 16, .hash = sha1_mb16_hash, .is_supported = sha1_mb16_supported },
+    { .name = "avx2", .lanes = 8, .hash = sha1_mb8_hash, .is_supported = sha1_mb8_supported },
+    { .name = "sse2", .lanes = 4, .hash = sha1_mb4_hash, .is_supported = sha1_mb4_supported },
+};
+
+#else
+
+/* Let the compiler use whatever 128 bit vectors the target has */
+#define MB_LANES 4
+#define MB_NAME(x) sha1_mb4_##x
+#define MB_TARGET
+#include "sha1_mb_lanes.h"
+#undef MB_TARGET
+#undef MB_NAME
+#undef MB_LANES
+
+static int sha1_mb4_supported(void) {
+    return 1;
+}
+
+static const sha1_mb_kernel_t sha1_mb_kernel_list[] = {
+    { .name = "simd4", .lanes = 4, .hash = sha1_mb4_hash, .is_supported = sha1_mb4_supported },
+};
+
+#endif
+#define SHA1_MB_KERNEL_COUNT (sizeof(sha1_mb_kernel_list) / sizeof(sha1_mb_kernel_list[0]))
+
+static const sha1_mb_kernel_t* sha1_mb_kernel = NULL;
+
+const sha1_mb_kernel_t* sha1_mb_kernels(int* count) {
+    *count = SHA1_MB_KERNEL_COUNT;
+    return sha1_mb_kernel_list;
+}
+
+int sha1_mb_kernel_select(const char* name) {
+    int has_sha_insn = 0;
+    if (!name) {
+        /* The single buffer kernels with SHA instructions are faster than
+         * the narrower ones. The portable kernel is always the last */
+        int count;
+        const sha1_kernel_t* k = sha1_kernels(&count);
+        for (int i = 0; i < count - 1; i++)
+            has_sha_insn |= k[i].is_supported();
+    }
+
+    for (int i = 0; i < SHA1_MB_KERNEL_COUNT; i++) {
+        const sha1_mb_kernel_t* k = &sha1_mb_kernel_list[i];
+        if (name && strcmp(name, k->name) != 0)
+            continue;
+        if (!name && has_sha_insn && k->lanes < 16)
+            continue;
+        if (!k->is_supported()) {
+            if (name)
+                return -1;
+            continue;
+        }
+        sha1_mb_kernel = k;
+        return 0;
+    }
+
+    if (name)
+        return -1;
+    sha1_mb_kernel = NULL;
+    return 0;
+}
+
+void sha1_mb_kernel_disable(void) {
+    sha1_mb_kernel = NULL;
+}
+
+const sha1_mb_kernel_t* sha1_mb_kernel_current(void) {
+    return sha1_mb_kernel;
+}
+
+__attribute__((constructor))
+static void sha1_mb_kernel_autoselect(void) {
+    sha1_mb_kernel_select(NULL);
+}
+
+/*
+ * The fewest buffers the kernel is faster for, than hashing them one by
+ * one. In the benchmarks, a lane is about 1/8 of the speed of the SHA
+ * instructions, and about 1/2.5 of the portable code
+ */
+static int sha1_mb_break_even(const sha1_mb_kernel_t* k) {
+    int count;
+    const sha1_kernel_t* kernels = sha1_kernels(&count);
+    int min = (sha1_kernel_current() != &kernels[count - 1]) ? 8 : 3;
+    return (min < k->lanes) ? min : k->lanes;
+}
+
+int sha1_mb_lanes(void) {
+    return (sha1_mb_kernel) ? sha1_mb_kernel->lanes : 1;
+}
+
+void sha1_mb(const unsigned char* const data[], size_t len, \
+        unsigned char digests[][20], int n) {
+    if (sha1_mb_kernel && n >= sha1_mb_break_even(sha1_mb_kernel)) {
+        sha1_mb_kernel->hash(data, len, digests, n);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        SHA1_CTX ctx;
+        SHA1Init(&ctx);
+        SHA1Update(&ctx, data[i], len);
+        SHA1Final(digests[i], &ctx);
+    }
+}
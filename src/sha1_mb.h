@@ -0,0 +1,67 @@
+#ifndef SHA1_MB_H
+#define SHA1_MB_H
+/*
+ * Multi-buffer SHA-1: hash several independent, equally long buffers in
+ * lock-step, one buffer per SIMD lane. This is for cpus without SHA
+ * instructions, where it's several times faster than hashing the buffers
+ * one after another.
+ */
+
+#include <stddef.h>
+
+#define SHA1_MB_MAX_LANES 16
+
+/*
+ * Hash 'n' buffers of 'len' bytes each from data[] into digests[].
+ * 'n' must be between 1 and the lanes of the kernel
+ */
+typedef void (*sha1_mb_fn)(const unsigned char* const data[], size_t len, \
+        unsigned char digests[][20], int n);
+
+typedef struct {
+    const char* name;
+    int lanes;
+    sha1_mb_fn hash;
+    /* Returns non-zero if the running cpu can use this kernel */
+    int (*is_supported)(void);
+} sha1_mb_kernel_t;
+
+/*
+ * Get the compiled in kernels, widest first
+ */
+const sha1_mb_kernel_t* sha1_mb_kernels(int* count);
+
+/*
+ * Select the kernel named 'name', or if 'name' is NULL, the widest
+ * supported one. If the cpu has SHA instructions, only 16 lane kernels
+ * are faster than those, so the narrower ones are not used then.
+ * Not thread safe, call it before hashing starts.
+ * Returns 0 on success, -1 if there is no such or it's not supported
+ */
+int sha1_mb_kernel_select(const char* name);
+
+/*
+ * Disable multi-buffer hashing, sha1_mb_lanes() will return 1
+ */
+void sha1_mb_kernel_disable(void);
+
+/*
+ * Get the selected kernel, or NULL if multi-buffer hashing is not used
+ */
+const sha1_mb_kernel_t* sha1_mb_kernel_current(void);
+
+/*
+ * Return how many buffers should be given to sha1_mb() at once,
+ * 1 if there is no multi-buffer kernel in use
+ */
+int sha1_mb_lanes(void);
+
+/*
+ * Hash n buffers of len bytes each, with the selected kernel, or one by
+ * one if there is none, or if n is too few for the kernel to be faster.
+ * n can be anything between 1 and sha1_mb_lanes()
+ */
+void sha1_mb(const unsigned char* const data[], size_t len, \
+        unsigned char digests[][20], int n);
+
+#endif
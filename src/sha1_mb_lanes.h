@@ -0,0 +1,122 @@
+/*
+ * Template of a multi-buffer SHA-1 kernel, included by sha1_mb.c once for
+ * every lane count. Before including, define:
+ *   MB_LANES   - number of lanes
+ *   MB_NAME(x) - makes a unique identifier from x
+ *   MB_TARGET  - function attributes for the target isa, may be empty
+ * The vector code uses gcc vector extensions, so the compiler picks the
+ * instructions for the target.
+ */
+
+typedef uint32_t MB_NAME(vec_t) __attribute__((vector_size(MB_LANES * 4)));
+
+typedef union {
+    MB_NAME(vec_t) v[16];
+    uint32_t l[16][MB_LANES];
+} MB_NAME(block_t);
+
+#define MB_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define MB_W(t) (w.v[(t) & 15] = MB_ROL(w.v[((t) + 13) & 15] ^ \
+            w.v[((t) + 8) & 15] ^ w.v[((t) + 2) & 15] ^ w.v[(t) & 15], 1))
+#define MB_ROUND(f, k, wt) \
+    tmp = MB_ROL(a, 5) + (f) + e + (k) + (wt); \
+    e = d; d = c; c = MB_ROL(b, 30); b = a; a = tmp;
+
+/* Hash one 64 byte block from each lane */
+static MB_TARGET void MB_NAME(compress)(MB_NAME(vec_t) state[5], \
+        const unsigned char* const blk[MB_LANES]) {
+    MB_NAME(block_t) w;
+    MB_NAME(vec_t) a, b, c, d, e, tmp;
+    int t;
+
+    /* Transpose, so w.v[t] has the t'th big endian word of every lane */
+    for (int l = 0; l < MB_LANES; l++) {
+        const unsigned char* p = blk[l];
+        for (t = 0; t < 16; t++, p += 4)
+            w.l[t][l] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | \
+                        (uint32_t)p[2] << 8 | p[3];
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    for (t = 0; t < 16; t++) {
+        MB_ROUND(d ^ (b & (c ^ d)), 0x5A827999, w.v[t]);
+    }
+    for (; t < 20; t++) {
+        MB_ROUND(d ^ (b & (c ^ d)), 0x5A827999, MB_W(t));
+    }
+    for (; t < 40; t++) {
+        MB_ROUND(b ^ c ^ d, 0x6ED9EBA1, MB_W(t));
+    }
+    for (; t < 60; t++) {
+        MB_ROUND((b & c) | (d & (b | c)), 0x8F1BBCDC, MB_W(t));
+    }
+    for (; t < 80; t++) {
+        MB_ROUND(b ^ c ^ d, 0xCA62C1D6, MB_W(t));
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static MB_TARGET void MB_NAME(hash)(const unsigned char* const data[], size_t len, \
+        unsigned char digests[][20], int n) {
+    const unsigned char* p[MB_LANES];
+    /* The last 1 or 2 blocks, with the padding */
+    unsigned char tail[MB_LANES][128];
+    MB_NAME(block_t) state;
+    size_t blocks = len / 64, rem = len % 64;
+    size_t tail_len = (rem < 56) ? 64 : 128;
+    uint64_t bits = (uint64_t)len << 3;
+
+    state.v[0] = (MB_NAME(vec_t)){} + 0x67452301;
+    state.v[1] = (MB_NAME(vec_t)){} + 0xEFCDAB89;
+    state.v[2] = (MB_NAME(vec_t)){} + 0x98BADCFE;
+    state.v[3] = (MB_NAME(vec_t)){} + 0x10325476;
+    state.v[4] = (MB_NAME(vec_t)){} + 0xC3D2E1F0;
+
+    /* Unused lanes hash the first buffer again, it's cheaper than masking */
+    for (int l = 0; l < MB_LANES; l++)
+        p[l] = data[(l < n) ? l : 0];
+
+    while (blocks--) {
+        MB_NAME(compress)(state.v, p);
+        for (int l = 0; l < MB_LANES; l++)
+            p[l] += 64;
+    }
+
+    for (int l = 0; l < MB_LANES; l++) {
+        memcpy(tail[l], p[l], rem);
+        tail[l][rem] = 0x80;
+        memset(&tail[l][rem + 1], 0, tail_len - rem - 1 - 8);
+        for (int i = 0; i < 8; i++)
+            tail[l][tail_len - 1 - i] = bits >> (i * 8);
+        p[l] = tail[l];
+    }
+    for (size_t off = 0; off < tail_len; off += 64) {
+        MB_NAME(compress)(state.v, p);
+        for (int l = 0; l < MB_LANES; l++)
+            p[l] += 64;
+    }
+
+    for (int l = 0; l < n; l++) {
+        for (int i = 0; i < 5; i++) {
+            uint32_t s = state.l[i][l];
+            digests[l][i * 4 + 0] = s >> 24;
+            digests[l][i * 4 + 1] = s >> 16;
+            digests[l][i * 4 + 2] = s >> 8;
+            digests[l][i * 4 + 3] = s;
+        }
+    }
+}
+
+#undef MB_ROUND
+#undef MB_W
+#undef MB_ROL
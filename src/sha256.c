@@ -0,0 +1,179 @@
+#include "sha256.h"
+#include <string.h>
+
+#include "sha256_hw.h"
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t* sha256_round_constants = sha256_k;
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_portable_blocks(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    uint32_t w[64];
+
+    while (blocks--) {
+        for (int t = 0; t < 16; t++, data += 4)
+            w[t] = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | \
+                   (uint32_t)data[2] << 8 | data[3];
+        for (int t = 16; t < 64; t++) {
+            uint32_t s0 = ROR(w[t - 15], 7) ^ ROR(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROR(w[t - 2], 17) ^ ROR(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            uint32_t s1 = ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + sha256_k[t] + w[t];
+            uint32_t s0 = ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#undef ROR
+
+static int sha256_portable_supported(void) {
+    return 1;
+}
+
+/* Fastest first, the portable one has to be the last */
+static const sha256_kernel_t sha256_kernel_list[] = {
+#ifdef SHA256_HW_X86
+    { .name = "sha-ni", .blocks = sha256_hw_x86_blocks, .is_supported = sha256_hw_x86_supported },
+#endif
+#ifdef SHA256_HW_ARMV8
+    { .name = "armv8-ce", .blocks = sha256_hw_armv8_blocks, .is_supported = sha256_hw_armv8_supported },
+#endif
+    { .name = "portable", .blocks = sha256_portable_blocks, .is_supported = sha256_portable_supported },
+};
+#define SHA256_KERNEL_COUNT (sizeof(sha256_kernel_list) / sizeof(sha256_kernel_list[0]))
+
+static const sha256_kernel_t* sha256_kernel = &sha256_kernel_list[SHA256_KERNEL_COUNT - 1];
+
+const sha256_kernel_t* sha256_kernels(int* count) {
+    *count = SHA256_KERNEL_COUNT;
+    return sha256_kernel_list;
+}
+
+int sha256_kernel_select(const char* name) {
+    for (int i = 0; i < SHA256_KERNEL_COUNT; i++) {
+        const sha256_kernel_t* k = &sha256_kernel_list[i];
+        if (name && strcmp(name, k->name) != 0)
+            continue;
+        if (!k->is_supported()) {
+            if (name)
+                return -1;
+            continue;
+        }
+        sha256_kernel = k;
+        return 0;
+    }
+    return -1;
+}
+
+const sha256_kernel_t* sha256_kernel_current(void) {
+    return sha256_kernel;
+}
+
+/* Pick the fastest kernel the cpu can run before main() */
+__attribute__((constructor))
+static void sha256_kernel_autoselect(void) {
+    sha256_kernel_select(NULL);
+}
+
+void sha256_init(sha256_ctx_t* ctx) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->count = 0;
+}
+
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t len) {
+    const unsigned char* p = data;
+    size_t used = ctx->count % 64;
+
+    ctx->count += len;
+    if (used) {
+        size_t n = 64 - used;
+        if (n > len) {
+            memcpy(&ctx->buffer[used], p, len);
+            return;
+        }
+        memcpy(&ctx->buffer[used], p, n);
+        sha256_kernel->blocks(ctx->state, ctx->buffer, 1);
+        p += n;
+        len -= n;
+    }
+
+    /* Whole blocks are hashed in place */
+    if (len >= 64) {
+        sha256_kernel->blocks(ctx->state, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    memcpy(ctx->buffer, p, len);
+}
+
+void sha256_final(sha256_ctx_t* ctx, unsigned char digest[SHA256_LEN]) {
+    size_t used = ctx->count % 64;
+    uint64_t bits = ctx->count << 3;
+
+    ctx->buffer[used++] = 0x80;
+    if (used > 56) {
+        memset(&ctx->buffer[used], 0, 64 - used);
+        sha256_kernel->blocks(ctx->state, ctx->buffer, 1);
+        used = 0;
+    }
+    memset(&ctx->buffer[used], 0, 56 - used);
+    for (int i = 0; i < 8; i++)
+        ctx->buffer[63 - i] = bits >> (i * 8);
+    sha256_kernel->blocks(ctx->state, ctx->buffer, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4 + 0] = ctx->state[i] >> 24;
+        digest[i * 4 + 1] = ctx->state[i] >> 16;
+        digest[i * 4 + 2] = ctx->state[i] >> 8;
+        digest[i * 4 + 3] = ctx->state[i];
+    }
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void sha256(const void* data, size_t len, unsigned char digest[SHA256_LEN]) {
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
@@ -0,0 +1,56 @@
+#ifndef SHA256_H
+#define SHA256_H
+/* SHA-256, for BitTorrent v2 */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    unsigned char buffer[64];
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t* ctx);
+void sha256_update(sha256_ctx_t* ctx, const void* data, size_t len);
+void sha256_final(sha256_ctx_t* ctx, unsigned char digest[SHA256_LEN]);
+
+/*
+ * Hash a buffer in one go
+ */
+void sha256(const void* data, size_t len, unsigned char digest[SHA256_LEN]);
+
+/*
+ * A block kernel hashes 'blocks' consecutive 64 byte blocks into state
+ */
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const unsigned char* data, size_t blocks);
+
+typedef struct {
+    const char* name;
+    sha256_blocks_fn blocks;
+    /* Returns non-zero if the running cpu can use this kernel */
+    int (*is_supported)(void);
+} sha256_kernel_t;
+
+/*
+ * Get the compiled in kernels, fastest first.
+ * The last one is the portable one, which is always supported
+ */
+const sha256_kernel_t* sha256_kernels(int* count);
+
+/*
+ * Select the kernel named 'name', or the fastest supported one if 'name'
+ * is NULL. The fastest is selected at startup.
+ * Not thread safe, call it before hashing starts.
+ * Returns 0 on success, or -1 if there is no such, or it's not supported
+ */
+int sha256_kernel_select(const char* name);
+
+/*
+ * Get the currently selected kernel
+ */
+const sha256_kernel_t* sha256_kernel_current(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include "sha256_hw.h"
+
+#ifdef SHA256_HW_X86
+#include <immintrin.h>
+#include "sha1_hw.h"
+
+int sha256_hw_x86_supported(void) {
+    /* Same cpuid bits as for SHA-1 */
+    return sha1_hw_x86_supported();
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_hw_x86_blocks(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const uint32_t* k = sha256_round_constants;
+    __m128i state0, state1, save0, save1, tmp, msg;
+    __m128i w[4];
+
+    /* The instructions want the state as ABEF and CDGH */
+    tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks--) {
+        save0 = state0;
+        save1 = state1;
+
+        /* 16 groups of 4 rounds, w[g & 3] holds the words of group g */
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = _mm_loadu_si128((const __m128i*)(data + g * 16));
+                w[g] = _mm_shuffle_epi8(w[g], bswap_mask);
+            } else {
+                tmp = _mm_alignr_epi8(w[(g - 1) & 3], w[(g - 2) & 3], 4);
+                tmp = _mm_add_epi32(_mm_sha256msg1_epu32(w[g & 3], w[(g - 3) & 3]), tmp);
+                w[g & 3] = _mm_sha256msg2_epu32(tmp, w[(g - 1) & 3]);
+            }
+
+            msg = _mm_add_epi32(w[g & 3], _mm_loadu_si128((const __m128i*)&k[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif /* SHA256_HW_X86 */
+
+#ifdef SHA256_HW_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+int sha256_hw_armv8_supported(void) {
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+
+__attribute__((target("+crypto")))
+void sha256_hw_armv8_blocks(uint32_t state[8], const unsigned char* data, size_t blocks) {
+    const uint32_t* k = sha256_round_constants;
+    uint32x4_t abcd, efgh, abcd_save, efgh_save, wk, tmp;
+    uint32x4_t w[4];
+
+    abcd = vld1q_u32(&state[0]);
+    efgh = vld1q_u32(&state[4]);
+
+    while (blocks--) {
+        abcd_save = abcd;
+        efgh_save = efgh;
+
+        for (int i = 0; i < 4; i++)
+            w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+        /* 16 groups of 4 rounds, w[g & 3] holds the words of group g */
+        for (int g = 0; g < 16; g++) {
+            wk = vaddq_u32(w[g & 3], vld1q_u32(&k[g * 4]));
+            tmp = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, wk);
+            efgh = vsha256h2q_u32(efgh, tmp, wk);
+
+            /* Schedule the words for group g + 4 */
+            if (g < 12)
+                w[g & 3] = vsha256su1q_u32(vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]), \
+                        w[(g + 2) & 3], w[(g + 3) & 3]);
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+        data += 64;
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+#endif /* SHA256_HW_ARMV8 */
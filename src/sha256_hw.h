@@ -0,0 +1,41 @@
+#ifndef SHA256_HW_H
+#define SHA256_HW_H
+/* SHA-256 block kernels using the cpu's SHA instructions */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The 64 round constants, from sha256.c */
+extern const uint32_t* sha256_round_constants;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HW_X86
+
+/*
+ * Hash 'blocks' 64 byte blocks with the x86 SHA extensions (SHA-NI)
+ * Only call this if sha256_hw_x86_supported() returned non-zero
+ */
+void sha256_hw_x86_blocks(uint32_t state[8], const unsigned char* data, size_t blocks);
+
+/*
+ * Return non-zero if the cpu has SHA-NI, SSSE3 and SSE4.1
+ */
+int sha256_hw_x86_supported(void);
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#define SHA256_HW_ARMV8
+
+/*
+ * Hash 'blocks' 64 byte blocks with the ARMv8 SHA2 crypto extension
+ * Only call this if sha256_hw_armv8_supported() returned non-zero
+ */
+void sha256_hw_armv8_blocks(uint32_t state[8], const unsigned char* data, size_t blocks);
+
+/*
+ * Return non-zero if the cpu reports the SHA2 hwcap
+ */
+int sha256_hw_armv8_supported(void);
+#endif
+
+#endif
@@ -5,6 +5,35 @@
 #include "util.h"
 #include "opts.h"
 
+/*
+ * Print the files from a v2 file tree, and return their total size
+ */
+static unsigned long showinfo_filetree(metainfo_t* m) {
+    char str_buff[100];
+    unsigned long total_size = 0;
+    filetree_iter_t iter;
+    filetree_info_t f;
+    int next;
+
+    if (metainfo_filetree_create(m, &iter) == -1)
+        return 0;
+    while ((next = metainfo_filetree_next(&iter, &f)) == 0) {
+        int pathlen = metainfo_filetree_path(&f, NULL);
+        char pathbuff[pathlen];
+        metainfo_filetree_path(&f, pathbuff);
+
+        if (util_byte2human(f.size, 1, -1, str_buff, sizeof(str_buff)) == -1) {
+            strncpy(str_buff, "err", sizeof(str_buff));
+        }
+
+        printf("\t%8s %.*s\n", str_buff, pathlen, pathbuff);
+        total_size += f.size;
+    }
+    if (next == -1)
+        printf("\t[Invalid entry, the files after it are not shown]\n");
+    return total_size;
+}
+
 void showinfo(metainfo_t* m) {
     const char* s;
     int slen;
@@ -20,6 +49,14 @@ void showinfo(metainfo_t* m) {
     util_byte2hex((const unsigned char*)metainfo_infohash(m), sizeof(sha1sum_t), 0, str_buff);
     printf("Info hash: %s\n", str_buff);
 
+    /* A v2 only torrent doesn't have the v1 pieces and files */
+    int v2_only = metainfo_is_v2(m) && metainfo_piece_count(m) == 0;
+    if (metainfo_is_v2(m)) {
+        util_byte2hex((const unsigned char*)metainfo_infohash_v2(m), sizeof(sha256sum_t), 0, str_buff);
+        printf("Info hash v2: %s\n", str_buff);
+        printf("Meta version: 2%s\n", v2_only ? "" : " (hybrid)");
+    }
+
     lint = metainfo_piece_count(m);
     printf("Piece count: %ld\n", lint);
 
@@ -28,8 +65,9 @@ void showinfo(metainfo_t* m) {
         strncpy(str_buff, "err", sizeof(str_buff));
     printf("Piece size: %ld (%s)\n", lint, str_buff);
 
-    printf("Is multi file: %s\n", metainfo_is_multi_file(m) ? "Yes" : "No");
-    if (metainfo_is_multi_file(m)) {
+    if (!v2_only)
+        printf("Is multi file: %s\n", metainfo_is_multi_file(m) ? "Yes" : "No");
+    if (!v2_only && metainfo_is_multi_file(m)) {
         printf("File count is: %ld\n", metainfo_file_count(m));
     }
 
@@ -58,38 +96,25 @@ void showinfo(metainfo_t* m) {
     printf("Files:\n");
 
     unsigned long total_size = 0;
-    fileinfo_t f;
-    if (metainfo_is_multi_file(m)) {
-        fileiter_t fi;
-        if (metainfo_fileiter_create(m, &fi) == 0) {
-            while (metainfo_file_next(&fi, &f) == 0) {
-                int pathlen = metainfo_fileinfo_path(&f, NULL);
-                char pathbuff[pathlen];
-                metainfo_fileinfo_path(&f, pathbuff);
-
-		        if (util_byte2human(f.size, 1, -1, str_buff, sizeof(str_buff)) == -1) {
-                    strncpy(str_buff, "err", sizeof(str_buff));
-                }
-
-                printf("\t%8s %.*s\n", str_buff, pathlen, pathbuff);
-
-                total_size += metainfo_fileinfo_size(&f);
-            }
-        }
+    if (v2_only) {
+        total_size = showinfo_filetree(m);
     } else {
-        metainfo_fileinfo(m, &f);
-        int pathlen = metainfo_fileinfo_path(&f, NULL);
-        char pathbuff[pathlen];
-        metainfo_fileinfo_path(&f, pathbuff);
+        const metainfo_file_t* files;
+        int file_count = metainfo_file_table(m, &files);
+        for (int i = 0; i < file_count; i++) {
+            const metainfo_file_t* f = &files[i];
+            /* Pad files are only there to align the others */
+            if (f->attr & METAINFO_ATTR_PAD)
+                continue;
+
+            if (util_byte2human(f->size, 1, -1, str_buff, sizeof(str_buff)) == -1) {
+                strncpy(str_buff, "err", sizeof(str_buff));
+            }
 
+            printf("\t%8s %.*s\n", str_buff, f->path_len, f->path);
 
-        if (util_byte2human(f.size, 1, -1, str_buff, sizeof(str_buff)) == -1) {
-            strncpy(str_buff, "err", sizeof(str_buff));
+            total_size += f->size;
         }
-
-        printf("\t%8s %.*s\n", str_buff, pathlen, pathbuff);
-
-        total_size = metainfo_fileinfo_size(&f);
     }
 
     if (util_byte2human(total_size, 1, -1, str_buff, sizeof(str_buff)) == -1)
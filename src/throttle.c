@@ -0,0 +1,125 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "throttle.h"
+#include "opts.h"
+
+#ifdef MT
+#include <pthread.h>
+#endif
+
+/* From linux/ioprio.h, libc doesn't have these */
+#define THROTTLE_IOPRIO_WHO_PROCESS 1
+#define THROTTLE_IOPRIO_CLASS_SHIFT 13
+#define THROTTLE_IOPRIO_CLASS_BE 2
+#define THROTTLE_IOPRIO_CLASS_IDLE 3
+
+/* A bucket can save up tokens for this many seconds */
+#define THROTTLE_BURST 0.1
+
+/* A token bucket, that can go into debt */
+typedef struct {
+    /* Tokens per second, or 0 if there is no limit */
+    double rate;
+    /* If negative, the takers sleep until it would be paid back */
+    double tokens;
+    /* When tokens was last updated, 0 if never */
+    double last;
+#ifdef MT
+    pthread_mutex_t mut;
+#endif
+} throttle_bucket_t;
+
+#ifdef MT
+#define THROTTLE_BUCKET_INIT { .mut = PTHREAD_MUTEX_INITIALIZER }
+#else
+#define THROTTLE_BUCKET_INIT { 0 }
+#endif
+
+/* Bytes read */
+static throttle_bucket_t throttle_read_bucket = THROTTLE_BUCKET_INIT;
+/* Seconds of CPU time */
+static throttle_bucket_t throttle_cpu_bucket = THROTTLE_BUCKET_INIT;
+
+/* The CPU time of the process when it was last accounted. That has the
+ * kernel's io_uring workers too, unlike the time of the threads */
+static double throttle_cpu_last = 0;
+
+static double throttle_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Take 'amount' tokens from the bucket, and sleep for the debt if there
+ * aren't enough
+ */
+static void throttle_take(throttle_bucket_t* b, double amount) {
+    if (b->rate <= 0 || amount <= 0)
+        return;
+
+    double now = throttle_clock(CLOCK_MONOTONIC);
+#ifdef MT
+    pthread_mutex_lock(&b->mut);
+#endif
+    double max = b->rate * THROTTLE_BURST;
+    b->tokens = (b->last == 0) ? max : b->tokens + (now - b->last) * b->rate;
+    if (b->tokens > max)
+        b->tokens = max;
+    b->last = now;
+    b->tokens -= amount;
+    double wait = (b->tokens < 0) ? -b->tokens / b->rate : 0;
+#ifdef MT
+    pthread_mutex_unlock(&b->mut);
+#endif
+
+    if (wait > 0) {
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+            ;
+    }
+}
+
+void throttle_init() {
+    static int done = 0;
+    if (done)
+        return;
+    done = 1;
+
+    throttle_read_bucket.rate = opt_max_read_rate;
+    throttle_cpu_bucket.rate = opt_max_cpu / 100.0;
+
+    if (opt_ionice != OPT_IONICE_NONE) {
+        int class = (opt_ionice == OPT_IONICE_IDLE) ? \
+                    THROTTLE_IOPRIO_CLASS_IDLE : THROTTLE_IOPRIO_CLASS_BE;
+        int prio = (class << THROTTLE_IOPRIO_CLASS_SHIFT) | opt_ionice_level;
+        if (syscall(SYS_ioprio_set, THROTTLE_IOPRIO_WHO_PROCESS, 0, prio) == -1)
+            fprintf(stderr, "Can't set the io priority: %s\n", strerror(errno));
+    }
+}
+
+void throttle_cpu() {
+    if (throttle_cpu_bucket.rate <= 0)
+        return;
+#ifdef MT
+    pthread_mutex_lock(&throttle_cpu_bucket.mut);
+#endif
+    double now = throttle_clock(CLOCK_PROCESS_CPUTIME_ID);
+    double used = now - throttle_cpu_last;
+    throttle_cpu_last = now;
+#ifdef MT
+    pthread_mutex_unlock(&throttle_cpu_bucket.mut);
+#endif
+    throttle_take(&throttle_cpu_bucket, used);
+}
+
+void throttle_read(long int bytes) {
+    throttle_cpu();
+    throttle_take(&throttle_read_bucket, bytes);
+}
@@ -0,0 +1,23 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+/* Limits on how much verifying can take from the rest of the system */
+
+/*
+ * Set the io priority from --ionice, threads started after this inherit
+ * it. This is done only once, later calls do nothing
+ */
+void throttle_init();
+
+/*
+ * Account 'bytes' that were, or are about to be read, and the CPU time
+ * like throttle_cpu(). Sleeps if it's over --max-read-rate or --max-cpu
+ */
+void throttle_read(long int bytes);
+
+/*
+ * Account the CPU time the process used since any thread last called
+ * this, and sleep if it's over --max-cpu
+ */
+void throttle_cpu();
+
+#endif
@@ -0,0 +1,162 @@
+#ifdef IO_URING
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int uring_sys_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_sys_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t* ring, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = uring_sys_setup(entries, &p);
+    if (ring->fd == -1)
+        return -1;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    /* Newer kernels map both rings at once */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, \
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto error;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, \
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto error;
+        }
+    }
+
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), \
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    uint8_t* sq = ring->sq_ring;
+    uint8_t* cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_entries = p.cq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
+
+error:
+    {
+        int err = errno;
+        uring_destroy(ring);
+        errno = err;
+    }
+    return -1;
+}
+
+void uring_destroy(uring_t* ring) {
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd != -1)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;
+
+    unsigned index = ring->sq_local_tail++ & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+    return &ring->sqes[index];
+}
+
+int uring_submit(uring_t* ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+    int ret;
+    do {
+        ret = uring_sys_enter(ring->fd, to_submit, wait_nr, \
+                (wait_nr) ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret == -1 && errno == EINTR);
+    return ret;
+}
+
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+struct io_uring_cqe* uring_wait_cqe(uring_t* ring) {
+    struct io_uring_cqe* cqe;
+    while (!(cqe = uring_peek_cqe(ring))) {
+        if (uring_submit(ring, 1) == -1)
+            return NULL;
+    }
+    return cqe;
+}
+
+void uring_cqe_seen(uring_t* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_buffers(uring_t* ring, const struct iovec* iovs, unsigned count) {
+    return uring_sys_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, count);
+}
+
+int uring_register_files(uring_t* ring, const int* fds, unsigned count) {
+    return uring_sys_register(ring->fd, IORING_REGISTER_FILES, fds, count);
+}
+
+int uring_update_file(uring_t* ring, unsigned index, int fd) {
+    struct io_uring_files_update up;
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.fds = (uintptr_t)&fd;
+    return (uring_sys_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &up, 1) == 1) ? 0 : -1;
+}
+
+#endif /* IO_URING */
@@ -0,0 +1,75 @@
+#if !defined(URING_H) && defined(IO_URING)
+#define URING_H
+/* A tiny io_uring wrapper, on the raw syscalls */
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned sq_entries, cq_entries;
+
+    /* The rings shared with the kernel */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    /* Entries got with uring_get_sqe(), but not yet given to the kernel */
+    unsigned sq_local_tail;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+} uring_t;
+
+/*
+ * Create a ring with at least 'entries' submission entries
+ * Returns 0 on success, or -1 and sets errno
+ */
+int uring_init(uring_t* ring, unsigned entries);
+void uring_destroy(uring_t* ring);
+
+/*
+ * Get a zeroed submission entry, or NULL if the queue is full
+ */
+struct io_uring_sqe* uring_get_sqe(uring_t* ring);
+
+/*
+ * Give the new entries to the kernel, and wait until at least 'wait_nr'
+ * completions are available
+ * Returns the number of entries submitted, or -1 and sets errno
+ */
+int uring_submit(uring_t* ring, unsigned wait_nr);
+
+/*
+ * Get the next completion, or NULL if there is none yet
+ */
+struct io_uring_cqe* uring_peek_cqe(uring_t* ring);
+
+/*
+ * Submit the queued entries, and wait for the next completion
+ * Returns NULL and sets errno on error
+ */
+struct io_uring_cqe* uring_wait_cqe(uring_t* ring);
+
+/*
+ * Mark the completion from peek or wait as consumed
+ */
+void uring_cqe_seen(uring_t* ring);
+
+/*
+ * Register buffers for IORING_OP_READ_FIXED, and files for
+ * IOSQE_FIXED_FILE. In the file table, -1 is an empty slot
+ * Return 0 on success, or -1 and set errno
+ */
+int uring_register_buffers(uring_t* ring, const struct iovec* iovs, unsigned count);
+int uring_register_files(uring_t* ring, const int* fds, unsigned count);
+
+/*
+ * Replace the registered file at slot 'index'
+ */
+int uring_update_file(uring_t* ring, unsigned index, int fd);
+
+#endif
@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "verified.h"
+
+/* The file is this, and then the records, in the byte order of the machine */
+#define VERIFIED_MAGIC "torrent-verify verified 1\n"
+#define VERIFIED_MAGIC_LEN (sizeof(VERIFIED_MAGIC) - 1)
+
+/* Rewrite the file with only the newest record of every file, when it has
+ * at least this many, and most are old */
+#define VERIFIED_COMPACT_MIN 4096
+
+/* The mtime_nsec of a record that marks a file as bad, no time has it */
+#define VERIFIED_BAD UINT32_MAX
+
+static struct {
+    int opened;
+    char* path;
+    /* Sorted by the file, there is only the newest one for every file */
+    verified_file_t* files;
+    int count, size;
+} verified_db;
+
+/*
+ * Compare which file of which torrent it is, but not what it's like
+ */
+static int verified_cmp(const void* a, const void* b) {
+    const verified_file_t* fa = (const verified_file_t*)a;
+    const verified_file_t* fb = (const verified_file_t*)b;
+    int res = memcmp(fa->info_hash, fb->info_hash, sizeof(fa->info_hash));
+    if (res != 0)
+        return res;
+    if (fa->file_index != fb->file_index)
+        return (fa->file_index < fb->file_index) ? -1 : 1;
+    if (fa->device != fb->device)
+        return (fa->device < fb->device) ? -1 : 1;
+    if (fa->inode != fb->inode)
+        return (fa->inode < fb->inode) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Like verified_cmp, but the older records come first. The records are
+ * numbered in 'reserved' while they are sorted
+ */
+static int verified_cmp_age(const void* a, const void* b) {
+    int res = verified_cmp(a, b);
+    if (res != 0)
+        return res;
+    uint32_t ra = ((const verified_file_t*)a)->reserved;
+    uint32_t rb = ((const verified_file_t*)b)->reserved;
+    return (ra > rb) - (ra < rb);
+}
+
+/*
+ * Sort the records, and keep only the newest of every file, unless it
+ * marks the file as bad
+ */
+static void verified_sort() {
+    for (int i = 0; i < verified_db.count; i++)
+        verified_db.files[i].reserved = i;
+    qsort(verified_db.files, verified_db.count, sizeof(verified_file_t), verified_cmp_age);
+
+    int count = 0;
+    for (int i = 0; i < verified_db.count; i++) {
+        if (count > 0 && verified_cmp(&verified_db.files[count - 1], &verified_db.files[i]) == 0)
+            count--;
+        verified_db.files[count] = verified_db.files[i];
+        verified_db.files[count++].reserved = 0;
+    }
+    int good = 0;
+    for (int i = 0; i < count; i++) {
+        if (verified_db.files[i].mtime_nsec != VERIFIED_BAD)
+            verified_db.files[good++] = verified_db.files[i];
+    }
+    verified_db.count = good;
+}
+
+/*
+ * Create the directories of the path, but not the file
+ * Returns 0 on success, -1 on error
+ */
+static int verified_mkdirs(char* path) {
+    for (char* p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int res = mkdir(path, 0700);
+        *p = '/';
+        if (res == -1 && errno != EEXIST)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write the records to 'fd', after the magic if 'magic'
+ * Returns 0 on success, -1 on error
+ */
+static int verified_write(int fd, int magic, const verified_file_t* files, int count) {
+    size_t len = count * sizeof(verified_file_t);
+    if (magic && write(fd, VERIFIED_MAGIC, VERIFIED_MAGIC_LEN) != VERIFIED_MAGIC_LEN)
+        return -1;
+    /* One write, appends of other processes don't get in between */
+    return (write(fd, files, len) == (ssize_t)len) ? 0 : -1;
+}
+
+/*
+ * Lock 'fd' for writing, and check that it's still the file at the path,
+ * it's replaced when it's compacted
+ * Returns 1 if it is, 0 if not, -1 on error
+ */
+static int verified_lock(int fd, struct stat* st) {
+    struct stat path_st;
+    if (flock(fd, LOCK_EX) == -1 || fstat(fd, st) == -1)
+        return -1;
+    if (stat(verified_db.path, &path_st) == -1)
+        return (errno == ENOENT) ? 0 : -1;
+    return path_st.st_dev == st->st_dev && path_st.st_ino == st->st_ino;
+}
+
+/*
+ * Replace the file, that was 'size' bytes when it was read, with the
+ * records in the memory, atomically. If it has changed since, it's left
+ * for the next time
+ */
+static void verified_compact(int fd, off_t size) {
+    struct stat st;
+    size_t len = strlen(verified_db.path);
+    char* tmp = malloc(len + sizeof(".XXXXXX"));
+    if (!tmp)
+        return;
+    memcpy(tmp, verified_db.path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    /* The lock is held until it's renamed, the writers waiting for it
+     * open the new file after */
+    if (verified_lock(fd, &st) == 1 && st.st_size == size) {
+        int tmp_fd = mkstemp(tmp);
+        if (tmp_fd != -1) {
+            int res = verified_write(tmp_fd, 1, verified_db.files, verified_db.count);
+            if (close(tmp_fd) == -1 || res == -1 || rename(tmp, verified_db.path) == -1)
+                unlink(tmp);
+        }
+    }
+    flock(fd, LOCK_UN);
+    free(tmp);
+}
+
+/*
+ * Open the file to append records, locked. A record at the end that's cut
+ * short, by a crash while it was written, is cut off, so the next ones
+ * start where they should. The magic is written if the file is new
+ * Returns the fd, or -1 on error
+ */
+static int verified_open_append() {
+    struct stat st;
+    for (;;) {
+        if (verified_mkdirs(verified_db.path) == -1)
+            return -1;
+        int fd = open(verified_db.path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (fd == -1)
+            return -1;
+        int res = verified_lock(fd, &st);
+        if (res == 1) {
+            off_t keep = 0;
+            if (st.st_size >= (off_t)VERIFIED_MAGIC_LEN)
+                keep = VERIFIED_MAGIC_LEN + (st.st_size - VERIFIED_MAGIC_LEN) / \
+                    sizeof(verified_file_t) * sizeof(verified_file_t);
+            if ((keep == st.st_size || ftruncate(fd, keep) == 0) && \
+                    (keep > 0 || verified_write(fd, 1, NULL, 0) == 0))
+                return fd;
+            res = -1;
+        }
+        close(fd);
+        if (res == -1)
+            return -1;
+    }
+}
+
+int verified_open() {
+    struct stat st;
+    const char* base = getenv("XDG_CACHE_HOME");
+    const char* sub = "/torrent-verify/verified";
+
+    if (verified_db.opened)
+        return 0;
+    if (!base || base[0] != '/') {
+        /* The default of XDG_CACHE_HOME */
+        base = getenv("HOME");
+        sub = "/.cache/torrent-verify/verified";
+        if (!base) {
+            fprintf(stderr, "Neither XDG_CACHE_HOME, nor HOME is set, "
+                            "there is nowhere to keep the verified files\n");
+            return -1;
+        }
+    }
+    if (!(verified_db.path = malloc(strlen(base) + strlen(sub) + 1))) {
+        fprintf(stderr, "Can't allocate the verified files\n");
+        return -1;
+    }
+    strcpy(verified_db.path, base);
+    strcat(verified_db.path, sub);
+    verified_db.opened = 1;
+
+    int fd = open(verified_db.path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return 0;
+        perror(verified_db.path);
+        return -1;
+    }
+
+    char magic[VERIFIED_MAGIC_LEN];
+    int result = -1;
+    if (fstat(fd, &st) == -1 || read(fd, magic, sizeof(magic)) != sizeof(magic) || \
+            memcmp(magic, VERIFIED_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a database of verified files\n", verified_db.path);
+        goto end;
+    }
+    /* A record that's cut short, by a crash while it was written, is skipped */
+    int count = (st.st_size - VERIFIED_MAGIC_LEN) / sizeof(verified_file_t);
+    if (count > 0 && !(verified_db.files = malloc(count * sizeof(verified_file_t)))) {
+        fprintf(stderr, "Can't allocate the verified files\n");
+        goto end;
+    }
+    size_t len = count * sizeof(verified_file_t);
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char*)verified_db.files + done, len - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror(verified_db.path);
+            goto end;
+        }
+        done += n;
+    }
+    verified_db.count = verified_db.size = count;
+    verified_sort();
+    if (count >= VERIFIED_COMPACT_MIN && verified_db.count < count / 2)
+        verified_compact(fd, st.st_size);
+    result = 0;
+
+end:
+    if (result == -1) {
+        free(verified_db.files);
+        verified_db.files = NULL;
+        verified_db.count = verified_db.size = 0;
+    }
+    close(fd);
+    return result;
+}
+
+int verified_has(const verified_file_t* f) {
+    const verified_file_t* found = bsearch(f, verified_db.files, verified_db.count, \
+            sizeof(verified_file_t), verified_cmp);
+    return found && found->size == f->size && found->mtime_sec == f->mtime_sec && \
+        found->mtime_nsec == f->mtime_nsec;
+}
+
+/*
+ * Append the records to the file, and to the ones in the memory
+ * Returns 0 on success, -1 on error
+ */
+static int verified_append(const verified_file_t* new, int new_count) {
+    int result = -1, fd;
+
+    if (new_count == 0)
+        return 0;
+    if ((fd = verified_open_append()) == -1 || verified_write(fd, 0, new, new_count) == -1) {
+        perror(verified_db.path);
+        goto end;
+    }
+
+    if (verified_db.count + new_count > verified_db.size) {
+        int size = verified_db.count + new_count;
+        verified_file_t* n = realloc(verified_db.files, size * sizeof(verified_file_t));
+        if (!n) {
+            fprintf(stderr, "Can't allocate the verified files\n");
+            goto end;
+        }
+        verified_db.files = n;
+        verified_db.size = size;
+    }
+    memcpy(verified_db.files + verified_db.count, new, new_count * sizeof(verified_file_t));
+    verified_db.count += new_count;
+    verified_sort();
+    result = 0;
+
+end:
+    /* This unlocks it too */
+    if (fd != -1)
+        close(fd);
+    return result;
+}
+
+int verified_add(const verified_file_t* files, int count) {
+    verified_file_t* new = malloc((count + 1) * sizeof(verified_file_t));
+    int new_count = 0;
+
+    if (!new) {
+        fprintf(stderr, "Can't allocate the verified files\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!verified_has(&files[i])) {
+            new[new_count] = files[i];
+            new[new_count++].reserved = 0;
+        }
+    }
+    int result = verified_append(new, new_count);
+    free(new);
+    return result;
+}
+
+int verified_remove(const verified_file_t* files, int count) {
+    verified_file_t* new = malloc((count + 1) * sizeof(verified_file_t));
+    int new_count = 0;
+
+    if (!new) {
+        fprintf(stderr, "Can't allocate the verified files\n");
+        return -1;
+    }
+    /* A newer record that matches nothing, the older ones are replaced */
+    for (int i = 0; i < count; i++) {
+        if (bsearch(&files[i], verified_db.files, verified_db.count, \
+                sizeof(verified_file_t), verified_cmp)) {
+            new[new_count] = files[i];
+            new[new_count].mtime_nsec = VERIFIED_BAD;
+            new[new_count++].reserved = 0;
+        }
+    }
+    int result = verified_append(new, new_count);
+    free(new);
+    return result;
+}
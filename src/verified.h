@@ -0,0 +1,49 @@
+#ifndef VERIFIED_H
+#define VERIFIED_H
+/*
+ * A database of the files that were verified, in $XDG_CACHE_HOME, so the
+ * pieces that are all in files that didn't change since can be skipped
+ */
+
+#include <stdint.h>
+
+/* A file of a torrent, as it was when all the pieces it's in were good.
+ * The path isn't in it, the hardlinks of a file are the same */
+typedef struct {
+    unsigned char info_hash[20];
+    /* Which file of the torrent it is */
+    uint32_t file_index;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t reserved;
+} verified_file_t;
+
+/*
+ * Read the database, this does nothing if it's already read
+ * Returns 0 on success, -1 on error
+ */
+int verified_open();
+
+/*
+ * Returns 1 if the file is in the database just like this, 0 if not
+ */
+int verified_has(const verified_file_t* f);
+
+/*
+ * Add the files to the database, the ones that are already in it are
+ * skipped
+ * Returns 0 on success, -1 on error
+ */
+int verified_add(const verified_file_t* files, int count);
+
+/*
+ * Mark the files as bad, the records of them don't match anymore, even
+ * if they still look the same
+ * Returns 0 on success, -1 on error
+ */
+int verified_remove(const verified_file_t* files, int count);
+
+#endif
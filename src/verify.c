@@ -1,12 +1,47 @@
+/* For O_DIRECT */
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 #include "verify.h"
-#include "sha1.h"
+#include "verify_v2.h"
+#include "hash.h"
 #include "opts.h"
+#include "uring.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "verified.h"
+
+/* Don't let a batch of huge pieces eat all the memory */
+#define VERIFY_BATCH_MAX_BYTES (64 * 1024 * 1024)
+
+/* A mapped file in mmap mode, or a piece buffer of the io_uring engine */
+typedef struct verify_map {
+    uint8_t* addr;
+    size_t len;
+    /* The reader has one while it's on the file, and every batch one per
+     * piece pointing into it. Only the main thread changes it */
+    int refs;
+    /* If set, this is called with the last reference instead of munmap */
+    void (*release)(struct verify_map* map);
+    /* The page cache of the mapped file, to drop it when it's unmapped */
+    struct verify_cache* cache;
+} verify_map_t;
 
 #ifdef MT
 #include <sys/sysinfo.h>
@@ -14,13 +49,22 @@
 #include <semaphore.h>
 
 typedef struct {
-    uint8_t* piece_data;
-    int piece_data_size;
+    /* A batch of pieces, each of them piece_data_size long */
+    const uint8_t* piece_ptr[HASH_MAX_LANES];
+    /* The mappings the pieces point into, or NULL */
+    verify_map_t* piece_map[HASH_MAX_LANES];
+    /* Buffers owned by the thread, the pieces may point into these */
+    uint8_t* piece_data[HASH_MAX_LANES];
+    int piece_count;
+    long int piece_data_size;
+    /* Index of the first piece in the batch */
     int piece_index;
     const sha1sum_t* expected_result;
-    int results_match;
+    /* Index of the first piece that didn't match, or -1 */
+    int bad_piece;
     int done;
 
+    hash_ctx_t* hash_ctx;
     sem_t sem_filled_buffer;
 } verify_thread_data_t;
 
@@ -41,27 +85,17 @@ static pthread_mutex_t mt_mut_tofill;
 static sem_t mt_sem_needs_fill;
 #endif
 
-/*
- * Check if file, or directory exists
- * Return 0 if yes, or errno
- */
-static int verify_file_exists(const char* path) {
-    if (access(path, F_OK|R_OK) == 0)
-        return 0;
-    return errno;
-}
-
 /*
  * Uselessly complex function to get the file path into a stack
  * buffer if the size is enough, or allocate one and copy it there
  * heap_str needs to be freed, if it's not null
  * Returns a pointer to the path string
  */
-static char* verify_get_path(fileinfo_t* finfo, const char* data_dir, \
+static char* verify_get_path(const metainfo_file_t* file, const char* data_dir, \
         size_t data_dir_len, const char* torrent_name, int torrent_name_len, \
         char* stack_str, size_t stack_str_size, \
         char** heap_str, size_t* heap_str_size) {
-    int path_len = metainfo_fileinfo_path(finfo, NULL);
+    int path_len = file->path_len;
     int req_len = path_len + data_dir_len + torrent_name_len + 1 + 1;
     char* path_ptr = stack_str;
     if (req_len > stack_str_size) {
@@ -90,12 +124,15 @@ static char* verify_get_path(fileinfo_t* finfo, const char* data_dir, \
     /* This may include multiple /'s but idc lol */
     *path_ptr_curr++ = '/';
 
-    path_ptr_curr += metainfo_fileinfo_path(finfo, path_ptr_curr);
+    memcpy(path_ptr_curr, file->path, file->path_len);
+    path_ptr_curr += file->path_len;
     *path_ptr_curr = '\0';
     return path_ptr;
 }
 
-typedef int (*fullpath_iter_cb)(const char* path, void* data);
+typedef int (*fullpath_iter_cb)(const char* path, const metainfo_file_t* file, void* data);
+/* Reads a file of the torrent from the opened 'fd', and closes it */
+typedef int (*verify_file_cb)(const char* path, int fd, void* data);
 
 /*
  * Call the callback function with every full path
@@ -116,27 +153,17 @@ static int verify_fullpath_iter(metainfo_t* m, const char* data_dir, \
 
     int result = 0;
     size_t data_dir_len = strlen(data_dir);
-    fileinfo_t finfo;
+    const metainfo_file_t* files;
+    int file_count = metainfo_file_table(m, &files);
 
-    if (metainfo_is_multi_file(m)) {
-        fileiter_t fiter;
+    if (metainfo_is_multi_file(m) && append_torrent_folder)
+        metainfo_name(m, &torrent_folder, &torrent_folder_len);
 
-        if (append_torrent_folder)
-            metainfo_name(m, &torrent_folder, &torrent_folder_len);
-
-        metainfo_fileiter_create(m, &fiter);
-        while (result == 0 && metainfo_file_next(&fiter, &finfo) == 0) {
-            char* path = verify_get_path(&finfo, data_dir, data_dir_len, \
-                    torrent_folder, torrent_folder_len, path_buffer, \
-                    sizeof(path_buffer), &path_heap_ptr, &path_heap_size);
-            result = cb(path, cb_data);
-        }
-    } else {
-        metainfo_fileinfo(m, &finfo);
-        char* path = verify_get_path(&finfo, data_dir, data_dir_len, \
+    for (int i = 0; result == 0 && i < file_count; i++) {
+        char* path = verify_get_path(&files[i], data_dir, data_dir_len, \
                 torrent_folder, torrent_folder_len, path_buffer, \
                 sizeof(path_buffer), &path_heap_ptr, &path_heap_size);
-        result = cb(path, cb_data);
+        result = cb(path, &files[i], cb_data);
     }
 
     if (path_heap_ptr)
@@ -144,29 +171,12 @@ static int verify_fullpath_iter(metainfo_t* m, const char* data_dir, \
     return result;
 }
 
-static int verify_is_files_exists_cb(const char* path, void* data) {
-    return verify_file_exists(path);
-}
-
-/*
- * Check if the files in the torrent exists, or not
- * If append_torrent_folder is 1 and the torrent is a multi file one,
- * the torrent name will be appended after data_dir
- * Return 0 if yes, and is readable, or an errno
- */
-static int verify_is_files_exists(metainfo_t* m, const char* data_dir, \
-        int append_torrent_folder) {
-
-    return verify_fullpath_iter(m, data_dir, append_torrent_folder, \
-            verify_is_files_exists_cb, NULL);
-}
-
 /*
  * Read in 1 piece size amount of data
  * Returns 0 if buffer got filled, -1 if error and 1 if end of the file
  */
-static int verify_read_piece(const char* path, FILE** f, int piece_size, \
-        uint8_t* out_bytes, int* out_bytes_size) {
+static int verify_read_piece(const char* path, FILE** f, long int piece_size, \
+        uint8_t* out_bytes, long int* out_bytes_size) {
     if (!*f) {
         /* If first file, open it */
         *f = fopen(path, "rb");
@@ -174,7 +184,7 @@ static int verify_read_piece(const char* path, FILE** f, int piece_size, \
             return -1;
     }
 
-    int read;
+    size_t read;
     out_bytes += *out_bytes_size;
     while (*out_bytes_size != piece_size && (read = fread(out_bytes, \
                     1, piece_size - *out_bytes_size, *f)) > 0) {
@@ -197,19 +207,395 @@ static int verify_read_piece(const char* path, FILE** f, int piece_size, \
     return 0;
 }
 
+/* Ask for read ahead this far in front of the reader */
+#define VERIFY_CACHE_WILLNEED (64 * 1024 * 1024)
+/* Look at the page cache of this much of a file at once, for drop-if-cold */
+#define VERIFY_CACHE_SCAN (1024 * 1024 * 1024)
+/*
+ * The page cache may hold a file in folios up to this large, and a folio
+ * is only dropped if the whole of it is in the range
+ */
+#define VERIFY_CACHE_FOLIO (2 * 1024 * 1024)
+
+typedef struct {
+    off_t start, end;
+} verify_range_t;
+
+/* Page cache handling of a file, see --cache */
+typedef struct verify_cache {
+    /* A dup of the file, or -1 if there is none */
+    int fd;
+    off_t size;
+    /* Read ahead was asked for until here */
+    off_t willneed_end;
+    /* drop-if-cold: the ranges that were cached when the file was opened */
+    verify_range_t* resident;
+    int resident_count;
+    /* Other readers read the file at the same time, and 'resident' is theirs
+     * too, it's not freed */
+    int shared;
+    /* If it's shared: what this reader has read in a row, the rest may be
+     * someone else's */
+    off_t run_start, run_end;
+} verify_cache_t;
+
+static long verify_page_size() {
+    static long page_size = 0;
+    if (!page_size)
+        page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+/*
+ * Find out which parts of the file are in the page cache already, and
+ * add them to 'resident'
+ */
+static void verify_cache_scan(int fd, off_t file_size, verify_range_t** resident, \
+        int* resident_count) {
+    long page = verify_page_size();
+    int size = *resident_count;
+
+    for (off_t off = 0; off < file_size; off += VERIFY_CACHE_SCAN) {
+        size_t len = (file_size - off > VERIFY_CACHE_SCAN) ? VERIFY_CACHE_SCAN : file_size - off;
+        size_t pages = (len + page - 1) / page;
+        /* Mapping doesn't read anything, it's just for mincore */
+        void* addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+        if (addr == MAP_FAILED)
+            return;
+        unsigned char* vec = malloc(pages);
+        if (!vec || mincore(addr, len, vec) == -1) {
+            free(vec);
+            munmap(addr, len);
+            return;
+        }
+
+        for (size_t i = 0; i < pages; i++) {
+            if (!(vec[i] & 1))
+                continue;
+            off_t start = off + (off_t)i * page;
+            if (*resident_count > 0 && (*resident)[*resident_count - 1].end == start) {
+                (*resident)[*resident_count - 1].end += page;
+                continue;
+            }
+            if (*resident_count == size) {
+                size = (size) ? size * 2 : 16;
+                verify_range_t* n = realloc(*resident, size * sizeof(verify_range_t));
+                if (!n)
+                    break;
+                *resident = n;
+            }
+            (*resident)[*resident_count].start = start;
+            (*resident)[(*resident_count)++].end = start + page;
+        }
+        free(vec);
+        munmap(addr, len);
+    }
+}
+
+/*
+ * Start tracking the file. This tells the kernel we read it in order
+ */
+static void verify_cache_open(verify_cache_t* c, int fd, off_t size) {
+    memset(c, 0, sizeof(*c));
+    c->fd = dup(fd);
+    c->size = size;
+    if (c->fd == -1)
+        return;
+
+    if (opt_cache == OPT_CACHE_DROP_IF_COLD)
+        verify_cache_scan(c->fd, size, &c->resident, &c->resident_count);
+    posix_fadvise(c->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/*
+ * Start tracking a file that other readers read at the same time. For
+ * drop-if-cold, 'resident' was scanned before any of them started, the
+ * pages they read, or asked to be read ahead, don't count
+ */
+static void verify_cache_open_shared(verify_cache_t* c, int fd, off_t size, \
+        verify_range_t* resident, int resident_count) {
+    memset(c, 0, sizeof(*c));
+    c->fd = dup(fd);
+    c->size = size;
+    c->shared = 1;
+    c->resident = resident;
+    c->resident_count = resident_count;
+    if (c->fd != -1)
+        posix_fadvise(c->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/*
+ * The reader got to 'offset', keep the read ahead window in front of it
+ */
+static void verify_cache_advance(verify_cache_t* c, off_t offset) {
+    if (c->fd == -1 || c->willneed_end >= c->size || \
+            offset + VERIFY_CACHE_WILLNEED / 2 < c->willneed_end)
+        return;
+
+    off_t start = (c->willneed_end > offset) ? c->willneed_end : offset;
+    c->willneed_end = offset + VERIFY_CACHE_WILLNEED;
+    posix_fadvise(c->fd, start, c->willneed_end - start, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * The range is hashed, or copied out of the cache. Drop it if the policy
+ * says so. The partial pages at the ends are dropped too, the next range
+ * reads them again at worst. The start goes back to a folio boundary, so a
+ * folio that the previous range ended in is dropped now. If the file is
+ * shared, the others may still read around the range, so it's not made
+ * larger than what this reader has read in a row
+ */
+static void verify_cache_done(verify_cache_t* c, off_t start, off_t end) {
+    if (c->fd == -1 || opt_cache == OPT_CACHE_KEEP)
+        return;
+
+    long page = verify_page_size();
+    if (c->shared) {
+        if (start != c->run_end)
+            c->run_start = start;
+        c->run_end = end;
+        start -= start % VERIFY_CACHE_FOLIO;
+        if (start < c->run_start)
+            start = c->run_start + ((c->run_start % page) ? page - c->run_start % page : 0);
+        end -= (end < c->size) ? end % page : 0;
+    } else {
+        start -= start % VERIFY_CACHE_FOLIO;
+        end += (end % page) ? page - end % page : 0;
+    }
+
+    /* Leave the pages alone, that someone else had in the cache */
+    for (int i = 0; i < c->resident_count && start < end; i++) {
+        verify_range_t* r = &c->resident[i];
+        if (r->end <= start)
+            continue;
+        if (r->start >= end)
+            break;
+        if (r->start > start)
+            posix_fadvise(c->fd, start, r->start - start, POSIX_FADV_DONTNEED);
+        start = r->end;
+    }
+    if (start < end)
+        posix_fadvise(c->fd, start, end - start, POSIX_FADV_DONTNEED);
+}
+
+static void verify_cache_close(verify_cache_t* c) {
+    if (c->fd != -1)
+        close(c->fd);
+    if (!c->shared)
+        free(c->resident);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
 typedef struct {
     metainfo_t* metai;
-    int piece_size;
-    uint8_t* piece_data;
-    int piece_data_size;
-#ifdef MT
-    const sha1sum_t* expected_piece_hash;
-#endif
+    long int piece_size;
+    /* Full pieces are collected into a batch, and hashed together */
+    const uint8_t* piece_ptr[HASH_MAX_LANES];
+    /* The mappings the pieces point into, or NULL if it's in piece_data */
+    verify_map_t* piece_map[HASH_MAX_LANES];
+    /* Buffers for the pieces that are read, or assembled by copying */
+    uint8_t* piece_data[HASH_MAX_LANES];
+    int piece_batch_size, piece_batch_count;
+    /* Bytes read into the piece after the full ones */
+    long int piece_data_size;
+    /* Index of the first piece in the batch */
     int piece_index;
+    hash_ctx_t* hash_ctx;
 
     int file_count, file_index;
 } verify_files_data_t;
 
+/*
+ * Map a whole file for reading
+ * Returns NULL on error
+ */
+static verify_map_t* verify_map_create(int fd, size_t len) {
+    verify_map_t* map = malloc(sizeof(verify_map_t));
+    if (!map)
+        return NULL;
+    map->addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map->addr == MAP_FAILED) {
+        free(map);
+        return NULL;
+    }
+    /* The pieces are hashed roughly in order, let readahead work */
+    madvise(map->addr, len, MADV_SEQUENTIAL);
+    map->len = len;
+    map->refs = 1;
+    map->release = NULL;
+    map->cache = NULL;
+    return map;
+}
+
+/*
+ * Drop a reference to a mapping, and unmap it with the last one
+ */
+static void verify_map_release(verify_map_t* map) {
+    if (map && --map->refs == 0) {
+        if (map->release) {
+            map->release(map);
+            return;
+        }
+        munmap(map->addr, map->len);
+        if (map->cache) {
+            verify_cache_done(map->cache, 0, map->len);
+            verify_cache_close(map->cache);
+            free(map->cache);
+        }
+        free(map);
+    }
+}
+
+static void verify_batch_release(verify_map_t** maps, int count) {
+    for (int i = 0; i < count; i++) {
+        verify_map_release(maps[i]);
+        maps[i] = NULL;
+    }
+}
+
+/* The marks of the pieces that aren't good, with --full */
+#define VERIFY_PIECE_BAD 1
+/* It's in a file that's missing, with --partial */
+#define VERIFY_PIECE_MISSING 2
+
+/* Remember the hash of this many all zero piece sizes */
+#define VERIFY_ZERO_CACHE 4
+
+typedef struct {
+    long int size;
+    sha1sum_t hash;
+} verify_zero_t;
+
+/* The hashes of all zero pieces, they are common in incomplete downloads */
+static verify_zero_t verify_zero_cache[VERIFY_ZERO_CACHE];
+static int verify_zero_next = 0;
+#ifdef MT
+static pthread_mutex_t verify_zero_mut = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Is the buffer all zeros? memcmp is vectorized, and it stops at the
+ * first byte that's not zero, so this is cheap on real data
+ */
+static int verify_is_zero(const uint8_t* buf, long int len) {
+    return len == 0 || (buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0);
+}
+
+/*
+ * Get the hash of 'size' zeros. If it's not known yet, the zeros at
+ * 'zeros' are hashed, or if it's NULL, a buffer of them is allocated
+ * Returns 0 on success, -1 on error
+ */
+static int verify_zero_hash(hash_ctx_t* ctx, const uint8_t* zeros, long int size, \
+        sha1sum_t out) {
+    int found = 0;
+#ifdef MT
+    pthread_mutex_lock(&verify_zero_mut);
+#endif
+    for (int i = 0; i < VERIFY_ZERO_CACHE && !found; i++) {
+        if (verify_zero_cache[i].size == size) {
+            memcpy(out, verify_zero_cache[i].hash, sizeof(sha1sum_t));
+            found = 1;
+        }
+    }
+#ifdef MT
+    pthread_mutex_unlock(&verify_zero_mut);
+#endif
+    if (found)
+        return 0;
+
+    uint8_t* buf = NULL;
+    if (!zeros && !(zeros = buf = calloc(1, size)))
+        return -1;
+    int res = hash_batch(ctx, &zeros, size, (sha1sum_t*)out, 1);
+    free(buf);
+    if (res == -1)
+        return -1;
+
+#ifdef MT
+    pthread_mutex_lock(&verify_zero_mut);
+#endif
+    verify_zero_cache[verify_zero_next].size = size;
+    memcpy(verify_zero_cache[verify_zero_next].hash, out, sizeof(sha1sum_t));
+    verify_zero_next = (verify_zero_next + 1) % VERIFY_ZERO_CACHE;
+#ifdef MT
+    pthread_mutex_unlock(&verify_zero_mut);
+#endif
+    return 0;
+}
+
+/*
+ * Hash a batch of 'count' pieces, 'size' bytes each, and compare them to
+ * the consecutive hashes at 'expected'. All zero pieces are only scanned,
+ * their hash is known.
+ * Returns the index in the batch of the first mismatching piece, or -1.
+ * If 'bad' isn't NULL, every mismatching piece that isn't marked yet is
+ * marked with VERIFY_PIECE_BAD in it instead, and -1 is returned.
+ * If hashing fails, the first piece is reported as mismatching, or all
+ * of them are marked
+ */
+static int verify_piece_batch_hash(hash_ctx_t* ctx, const uint8_t* const* pieces, \
+        int count, long int size, const sha1sum_t* expected, uint8_t* bad) {
+    sha1sum_t results[HASH_MAX_LANES];
+    sha1sum_t hashed_results[HASH_MAX_LANES];
+    const uint8_t* hashed[HASH_MAX_LANES];
+    int hashed_index[HASH_MAX_LANES];
+    int hashed_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (verify_is_zero(pieces[i], size) && \
+                verify_zero_hash(ctx, pieces[i], size, results[i]) == 0)
+            continue;
+        hashed_index[hashed_count] = i;
+        hashed[hashed_count++] = pieces[i];
+    }
+
+    int res = (hashed_count > 0) ? hash_batch(ctx, hashed, size, hashed_results, hashed_count) : 0;
+    throttle_cpu();
+    if (res == -1) {
+        if (!bad)
+            return 0;
+        for (int i = 0; i < count; i++)
+            bad[i] = (bad[i]) ? bad[i] : VERIFY_PIECE_BAD;
+        return -1;
+    }
+    for (int i = 0; i < hashed_count; i++)
+        memcpy(results[hashed_index[i]], hashed_results[i], sizeof(sha1sum_t));
+    for (int i = 0; i < count; i++) {
+        if (memcmp(results[i], expected[i], sizeof(sha1sum_t)) != 0) {
+            if (!bad)
+                return i;
+            if (!bad[i])
+                bad[i] = VERIFY_PIECE_BAD;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Hash 'count' pieces starting from 'piece_index', and compare them to
+ * the hashes in the torrent
+ * Returns 0 if all of them match, -1 if not
+ */
+static int verify_piece_batch(metainfo_t* m, hash_ctx_t* ctx, \
+        const uint8_t* const* pieces, int count, long int size, int piece_index) {
+    const sha1sum_t* expected;
+
+    if (metainfo_piece_index(m, piece_index + count - 1, &expected) == -1 || \
+            metainfo_piece_index(m, piece_index, &expected) == -1) {
+        fprintf(stderr, "Piece meta hash reading failed at %d\n", piece_index);
+        return -1;
+    }
+
+    int bad = verify_piece_batch_hash(ctx, pieces, count, size, expected, NULL);
+    if (bad != -1) {
+        fprintf(stderr, "Error at piece: %d\n", piece_index + bad);
+        return -1;
+    }
+    return 0;
+}
+
 #ifdef MT
 
 static void verify_piece_hash_mt_cond_cleanup(void* arg) {
@@ -240,214 +626,2898 @@ static void* verify_piece_hash_mt(void* param) {
         }
 
         /* Work on the data */
-        sha1sum_t result;
-        SHA1_CTX ctx;
-        SHA1Init(&ctx);
-        SHA1Update(&ctx, data->piece_data, data->piece_data_size);
-        SHA1Final(result, &ctx);
-
-        /* Compare the data */
-        if (memcmp(result, data->expected_result, sizeof(sha1sum_t)) != 0) {
-            data->results_match = 0;
-        } else {
-            data->results_match = 1;
-        }
+        int bad = verify_piece_batch_hash(data->hash_ctx, data->piece_ptr, \
+                data->piece_count, data->piece_data_size, data->expected_result, NULL);
+        data->bad_piece = (bad == -1) ? -1 : data->piece_index + bad;
     }
     return 0;
 }
 
-#else
-
-static void verify_piece_hash(uint8_t* piece_data, int piece_size, sha1sum_t result) {
-    SHA1_CTX ctx;
-    SHA1Init(&ctx);
-    SHA1Update(&ctx, piece_data, piece_size);
-    SHA1Final(result, &ctx);
+/*
+ * Check the result of the last batch of a thread, and drop its mappings.
+ * mt_mut_tofill has to be locked. Returns -1 if a piece didn't match
+ */
+static int verify_mt_batch_result(verify_thread_data_t* td) {
+    verify_batch_release(td->piece_map, td->piece_count);
+    if (td->piece_count > 0 && td->bad_piece != -1) {
+        fprintf(stderr, "Error at piece: %d\n", td->bad_piece);
+        return -1;
+    }
+    return 0;
 }
 
-#endif
-
-#ifdef MT
-#include <time.h>
-/* MT magic oOoOOoOOoOoo */
-static int verify_files_cb(const char* path, void* data) {
-    verify_files_data_t* vfi = (verify_files_data_t*)data;
-    FILE* f = NULL;
-    int read_piece_result = 0;
+/*
+ * Wait until every thread is done with its batch, and check them
+ * Returns -1 if a piece didn't match
+ */
+static int verify_mt_drain() {
     int result = 0;
 
-    if (!opt_silent) {
-        vfi->file_index++;
-        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
-    }
-    for (;;) {
-        /* If we don't have enough data to give to the threads, read it here */
-        if (vfi->piece_data_size != vfi->piece_size) {
-            read_piece_result = verify_read_piece(path, &f, vfi->piece_size, \
-                    vfi->piece_data, &vfi->piece_data_size);
-            if (read_piece_result == 1) {
-                /* End of file, try the next one */
-                break;
-            } else if (read_piece_result == -1) {
-                /* Something failed */
-                result = -1;
-                fprintf(stderr, "Reading piece: %d failed\n", vfi->piece_index);
-                break;
-            }
-            /* Else, buffer got filled, read target piece hash and continue */
-            if (metainfo_piece_index(vfi->metai, vfi->piece_index, &vfi->expected_piece_hash) == -1) {
-                fprintf(stderr, "Piece meta hash reading failed at %d\n", vfi->piece_index);
-                break;
-            }
-            /* BUT don't increment piece_index here, because it will be copied into a thread */
-        }
-        
-        /* Wait until a thread signals us to fill it's buffer, and check result */
+    /* A thread that asked for a fill won't ask again until it's filled,
+     * so this will be every thread once */
+    for (int i = 0; i < mt_max_thread; i++) {
         sem_wait(&mt_sem_needs_fill);
         pthread_mutex_lock(&mt_mut_tofill);
 
-        if (mt_td_tofill->piece_data_size == vfi->piece_size && \
-                !mt_td_tofill->results_match) {
-            /* If there was a hash at least once and vertif failed */
-            fprintf(stderr, "Error at piece: %d\n", \
-                    mt_td_tofill->piece_index);
-
-            pthread_mutex_unlock(&mt_mut_tofill);
+        if (verify_mt_batch_result(mt_td_tofill) == -1)
             result = -1;
-            goto end;
-        }
-
-        mt_td_tofill->piece_index = vfi->piece_index;
-        mt_td_tofill->piece_data_size = vfi->piece_data_size;
-        mt_td_tofill->expected_result = vfi->expected_piece_hash;
-        vfi->piece_index++;
-
-        /* Reset variable so we will read next piece */
-        vfi->piece_data_size = 0;
-
-        /* Swap buffers */
-        uint8_t* tmp = vfi->piece_data;
-        vfi->piece_data = mt_td_tofill->piece_data;
-        mt_td_tofill->piece_data = tmp;
-
-        /* Send thread to work */
-        sem_post(&mt_td_tofill->sem_filled_buffer);
+        mt_td_tofill->piece_count = 0;
         mt_td_tofill = NULL;
 
-        /* Tell threads its okay to fill the tofill pointer */
         pthread_cond_signal(&mt_cond_tofill);
         pthread_mutex_unlock(&mt_mut_tofill);
     }
-
-end:
-    if (f)
-        fclose(f);
-    if (read_piece_result == -1) {
-        return -1;
-    }
     return result;
 }
 
-#else
+/*
+ * Give the full batch to the next free thread, after checking the result
+ * of its previous one
+ * Returns -1 if a piece didn't match
+ */
+static int verify_batch_submit(verify_files_data_t* vfi) {
+    const sha1sum_t* expected;
+    if (metainfo_piece_index(vfi->metai, vfi->piece_index + vfi->piece_batch_count - 1, &expected) == -1 || \
+            metainfo_piece_index(vfi->metai, vfi->piece_index, &expected) == -1) {
+        fprintf(stderr, "Piece meta hash reading failed at %d\n", vfi->piece_index);
+        return -1;
+    }
 
-static int verify_files_cb(const char* path, void* data) {
-    verify_files_data_t* vfi = (verify_files_data_t*)data;
-    FILE* f = NULL;
-    int ver_res;
+    /* Wait until a thread signals us to fill it's buffer, and check result */
+    sem_wait(&mt_sem_needs_fill);
+    pthread_mutex_lock(&mt_mut_tofill);
 
-    if (!opt_silent) {
-        vfi->file_index++;
-        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
+    if (verify_mt_batch_result(mt_td_tofill) == -1) {
+        pthread_mutex_unlock(&mt_mut_tofill);
+        return -1;
     }
-    while ((ver_res = verify_read_piece(path, &f, vfi->piece_size, \
-                vfi->piece_data, &vfi->piece_data_size)) == 0) {
-        if (vfi->piece_size != vfi->piece_data_size) {
-            fprintf(stderr, "piece_size != piece_data_size at hash\n");
-        }
-
-        sha1sum_t curr_piece_sum;
-        verify_piece_hash(vfi->piece_data, vfi->piece_data_size, curr_piece_sum);
 
-        const sha1sum_t* target_piece_sum;
-        if (metainfo_piece_index(vfi->metai, vfi->piece_index, &target_piece_sum) == -1)
-            goto error;
+    mt_td_tofill->piece_index = vfi->piece_index;
+    mt_td_tofill->piece_count = vfi->piece_batch_count;
+    mt_td_tofill->piece_data_size = vfi->piece_size;
+    mt_td_tofill->expected_result = expected;
+    for (int i = 0; i < vfi->piece_batch_count; i++) {
+        mt_td_tofill->piece_ptr[i] = vfi->piece_ptr[i];
+        mt_td_tofill->piece_map[i] = vfi->piece_map[i];
+        vfi->piece_map[i] = NULL;
+    }
+    vfi->piece_index += vfi->piece_batch_count;
 
-        if (memcmp(curr_piece_sum, target_piece_sum, sizeof(sha1sum_t)) != 0)
-            goto error;
+    /* Reset variable so we will read next batch */
+    vfi->piece_batch_count = 0;
 
-        vfi->piece_index++;
-        vfi->piece_data_size = 0;
+    /* Swap buffers, the pieces may point into these */
+    for (int i = 0; i < vfi->piece_batch_size; i++) {
+        uint8_t* tmp = vfi->piece_data[i];
+        vfi->piece_data[i] = mt_td_tofill->piece_data[i];
+        mt_td_tofill->piece_data[i] = tmp;
     }
 
-    if (ver_res == -1)
-        return -1;
+    /* Send thread to work */
+    sem_post(&mt_td_tofill->sem_filled_buffer);
+    mt_td_tofill = NULL;
+
+    /* Tell threads its okay to fill the tofill pointer */
+    pthread_cond_signal(&mt_cond_tofill);
+    pthread_mutex_unlock(&mt_mut_tofill);
     return 0;
-error:
-    fprintf(stderr, "Error at piece: %d\n", vfi->piece_index);
-    if (f)
-        fclose(f);
-    return -1;
 }
+
+#else
+
+/*
+ * Hash the full batch here
+ * Returns -1 if a piece didn't match
+ */
+static int verify_batch_submit(verify_files_data_t* vfi) {
+    int result = verify_piece_batch(vfi->metai, vfi->hash_ctx, vfi->piece_ptr, \
+            vfi->piece_batch_count, vfi->piece_size, vfi->piece_index);
+
+    verify_batch_release(vfi->piece_map, vfi->piece_batch_count);
+    vfi->piece_index += vfi->piece_batch_count;
+    vfi->piece_batch_count = 0;
+    return result;
+}
+
 #endif
 
 /*
- * Returns 0 if all files match
+ * Add a full piece to the batch, holding a reference to 'map' if it
+ * points into one, and submit the batch if it's full
+ * Returns -1 if a piece didn't match
  */
-static int verify_files(metainfo_t* m, const char* data_dir, \
-        int append_torrent_folder) {
-    int result = 0;
+static int verify_piece_add(verify_files_data_t* vfi, const uint8_t* piece, \
+        verify_map_t* map) {
+    vfi->piece_ptr[vfi->piece_batch_count] = piece;
+    vfi->piece_map[vfi->piece_batch_count] = map;
+    if (map)
+        map->refs++;
+    vfi->piece_data_size = 0;
 
-#if MT
-    mt_max_thread = get_nprocs_conf();
-    pthread_mutex_init(&mt_mut_tofill, 0);
-    sem_init(&mt_sem_needs_fill, 0, 0);
-    pthread_cond_init(&mt_cond_tofill, 0);
-    mt_threads = calloc(mt_max_thread, sizeof(verify_thread_t));
-    for (int i = 0; i < mt_max_thread; i++) {
-        mt_threads[i].thread_data.piece_data = malloc(metainfo_piece_size(m));
-        sem_init(&mt_threads[i].thread_data.sem_filled_buffer, 0, 0);
-        if (pthread_create(&mt_threads[i].thread, NULL, verify_piece_hash_mt, &mt_threads[i].thread_data) != 0) {
-            perror("Thread creation failed: ");
-            exit(EXIT_FAILURE);
-        }
+    if (++vfi->piece_batch_count == vfi->piece_batch_size)
+        return verify_batch_submit(vfi);
+    return 0;
+}
+
+/*
+ * Copy bytes into the piece that's being assembled in piece_data
+ * Returns the bytes used up, or -1 on error
+ */
+static long verify_piece_append(verify_files_data_t* vfi, const uint8_t* src, size_t len) {
+    uint8_t** buf = &vfi->piece_data[vfi->piece_batch_count];
+    if (!*buf && !(*buf = malloc(vfi->piece_size))) {
+        fprintf(stderr, "Can't allocate piece buffer\n");
+        return -1;
     }
-#endif
 
-    verify_files_data_t data;
-    data.piece_size = metainfo_piece_size(m);
-    data.piece_data = malloc(data.piece_size);
-    data.piece_data_size = 0;
-    data.piece_index = 0;
-    data.metai = m;
+    size_t n = vfi->piece_size - vfi->piece_data_size;
+    if (n > len)
+        n = len;
+    memcpy(*buf + vfi->piece_data_size, src, n);
+    vfi->piece_data_size += n;
+
+    if (vfi->piece_data_size == vfi->piece_size && verify_piece_add(vfi, *buf, NULL) == -1)
+        return -1;
+    return n;
+}
+
+static int verify_files_cb(const char* path, int fd, void* data) {
+    verify_files_data_t* vfi = (verify_files_data_t*)data;
+    verify_cache_t cache;
+    struct stat st;
+    off_t offset = 0;
+    int ver_res;
 
     if (!opt_silent) {
-        data.file_count = metainfo_file_count(m);
-        data.file_index = 0;
+        vfi->file_index++;
+        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
     }
-    
-    int vres = verify_fullpath_iter(m, data_dir, append_torrent_folder, \
-            verify_files_cb, &data);
-    if (vres != 0) {
-        result = vres;
-        goto end;
+    FILE* f = fdopen(fd, "rb");
+    if (!f) {
+        close(fd);
+        return -1;
+    }
+    if (fstat(fileno(f), &st) == -1) {
+        fclose(f);
+        return -1;
     }
+    verify_cache_open(&cache, fileno(f), st.st_size);
 
-    /* Here, we still have one piece left */
-    sha1sum_t curr_piece_sum;
-    SHA1_CTX ctx;
-    SHA1Init(&ctx);
-    SHA1Update(&ctx, data.piece_data, data.piece_data_size);
-    SHA1Final(curr_piece_sum, &ctx);
+    /* The data is copied into the piece buffer, the cache can go then */
+    for (;;) {
+        long int before = vfi->piece_data_size;
+        verify_cache_advance(&cache, offset);
+        ver_res = verify_read_piece(path, &f, vfi->piece_size, \
+                vfi->piece_data[vfi->piece_batch_count], &vfi->piece_data_size);
+        if (ver_res == -1)
+            break;
+        verify_cache_done(&cache, offset, offset + vfi->piece_data_size - before);
+        throttle_read(vfi->piece_data_size - before);
+        offset += vfi->piece_data_size - before;
+        if (ver_res == 1)
+            break;
 
-    const sha1sum_t* target_piece_sum;
-    if (metainfo_piece_index(m, data.piece_index, &target_piece_sum) == -1) {
-        result = -1;
-        goto end;
+        if (verify_piece_add(vfi, vfi->piece_data[vfi->piece_batch_count], NULL) == -1) {
+            fclose(f);
+            verify_cache_close(&cache);
+            return -1;
+        }
     }
+    verify_cache_close(&cache);
 
-    if (memcmp(curr_piece_sum, target_piece_sum, sizeof(sha1sum_t)) != 0) {
-        result = -1;
-        goto end;
+    if (ver_res == -1) {
+        fprintf(stderr, "Reading piece: %d failed\n", \
+                vfi->piece_index + vfi->piece_batch_count);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Map the file, and give out pointers into the mapping for the pieces that
+ * are inside this file. Only the pieces spanning files are copied
+ */
+static int verify_files_mmap_cb(const char* path, int fd, void* data) {
+    verify_files_data_t* vfi = (verify_files_data_t*)data;
+    verify_map_t* map = NULL;
+    struct stat st;
+    int result = -1;
+
+    if (!opt_silent) {
+        vfi->file_index++;
+        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
+    }
+
+    if (fstat(fd, &st) == -1)
+        goto end;
+    if (st.st_size == 0) {
+        result = 0;
+        goto end;
+    }
+    map = verify_map_create(fd, st.st_size);
+    if (!map) {
+        fprintf(stderr, "Can't map file: %s: %s\n", path, strerror(errno));
+        goto end;
+    }
+    /* The pages are dropped when every piece in it is hashed */
+    if (opt_cache != OPT_CACHE_KEEP && (map->cache = malloc(sizeof(verify_cache_t))))
+        verify_cache_open(map->cache, fd, st.st_size);
+
+    /* The pages are read when they are hashed, this is accounted before */
+    size_t offset = 0;
+    /* Finish the piece that the previous files started */
+    if (vfi->piece_data_size > 0) {
+        long used = verify_piece_append(vfi, map->addr, map->len);
+        if (used == -1)
+            goto end;
+        throttle_read(used);
+        offset += used;
+    }
+
+    for (; map->len - offset >= vfi->piece_size; offset += vfi->piece_size) {
+        throttle_read(vfi->piece_size);
+        if (verify_piece_add(vfi, map->addr + offset, map) == -1)
+            goto end;
+    }
+
+    if (offset < map->len) {
+        throttle_read(map->len - offset);
+        if (verify_piece_append(vfi, map->addr + offset, map->len - offset) == -1)
+            goto end;
+    }
+    result = 0;
+
+end:
+    /* The batches keep their own references */
+    verify_map_release(map);
+    close(fd);
+    return result;
+}
+
+/* O_DIRECT reads have to be aligned to this, in the file and in memory */
+#define VERIFY_DIRECT_ALIGN 4096
+/* Read about this much at once with --direct, in whole pieces */
+#define VERIFY_DIRECT_CHUNK (8 * 1024 * 1024)
+
+#define VERIFY_ALIGN_DOWN(x) ((x) & ~(off_t)(VERIFY_DIRECT_ALIGN - 1))
+#define VERIFY_ALIGN_UP(x) VERIFY_ALIGN_DOWN((x) + VERIFY_DIRECT_ALIGN - 1)
+
+/* Aligned read buffers of --direct, they come back when they are hashed */
+static struct {
+    size_t buf_size;
+    verify_map_t** all;
+    verify_map_t** free;
+    int count, free_count;
+} direct_pool;
+
+static void verify_direct_buf_release(verify_map_t* map) {
+    direct_pool.free[direct_pool.free_count++] = map;
+}
+
+/*
+ * Get a buffer from the pool, or allocate a new one
+ * Returns NULL on error
+ */
+static verify_map_t* verify_direct_buf_get() {
+    if (direct_pool.free_count > 0) {
+        verify_map_t* map = direct_pool.free[--direct_pool.free_count];
+        map->refs = 1;
+        return map;
+    }
+
+    verify_map_t** all = realloc(direct_pool.all, (direct_pool.count + 1) * sizeof(verify_map_t*));
+    if (!all)
+        return NULL;
+    direct_pool.all = all;
+    verify_map_t** free_list = realloc(direct_pool.free, (direct_pool.count + 1) * sizeof(verify_map_t*));
+    if (!free_list)
+        return NULL;
+    direct_pool.free = free_list;
+
+    verify_map_t* map = malloc(sizeof(verify_map_t));
+    if (!map)
+        return NULL;
+    if (posix_memalign((void**)&map->addr, VERIFY_DIRECT_ALIGN, direct_pool.buf_size) != 0) {
+        free(map);
+        return NULL;
+    }
+    map->len = direct_pool.buf_size;
+    map->refs = 1;
+    map->release = verify_direct_buf_release;
+    direct_pool.all[direct_pool.count++] = map;
+    return map;
+}
+
+static void verify_direct_pool_destroy() {
+    for (int i = 0; i < direct_pool.count; i++) {
+        free(direct_pool.all[i]->addr);
+        free(direct_pool.all[i]);
+    }
+    free(direct_pool.all);
+    free(direct_pool.free);
+    memset(&direct_pool, 0, sizeof(direct_pool));
+}
+
+/*
+ * Read the range from 'start' to 'end' of the file into an aligned buffer.
+ * 'start' has to be aligned, the end is rounded up, so the file tail can
+ * be read too. If the file couldn't be opened with O_DIRECT, the pages are
+ * dropped from the cache after the read instead
+ * Returns the buffer, or NULL on error, or if the file is shorter
+ */
+static verify_map_t* verify_direct_read(int fd, int is_direct, off_t start, off_t end) {
+    verify_map_t* buf = verify_direct_buf_get();
+    if (!buf) {
+        fprintf(stderr, "Can't allocate read buffer\n");
+        return NULL;
+    }
+
+    size_t len = VERIFY_ALIGN_UP(end) - start;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, buf->addr + done, len - done, start + done);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        done += r;
+    }
+    throttle_read(done);
+    if (!is_direct)
+        posix_fadvise(fd, start, len, POSIX_FADV_DONTNEED);
+
+    if (done < end - start) {
+        verify_map_release(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Read the file with O_DIRECT, in chunks of whole pieces. The chunks start
+ * at the aligned offset before the first piece, so the pieces are unaligned
+ * in the buffer, but only the pieces that span files have to be copied
+ */
+static int verify_files_direct_cb(const char* path, int fd, void* data) {
+    verify_files_data_t* vfi = (verify_files_data_t*)data;
+    verify_map_t* buf;
+    struct stat st;
+    int result = -1;
+
+    if (!opt_silent) {
+        vfi->file_index++;
+        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
+    }
+
+    /* Fails if the filesystem doesn't do O_DIRECT */
+    int flags = fcntl(fd, F_GETFL);
+    int is_direct = (flags != -1 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0);
+    if (fstat(fd, &st) == -1)
+        goto end;
+
+    off_t offset = 0;
+    long chunk_pieces = VERIFY_DIRECT_CHUNK / vfi->piece_size;
+    if (chunk_pieces < 1)
+        chunk_pieces = 1;
+
+    while (offset < st.st_size) {
+        off_t full = (st.st_size - offset) / vfi->piece_size;
+        if (full > chunk_pieces)
+            full = chunk_pieces;
+
+        /* The end of a piece that the previous files started, or the tail */
+        if (vfi->piece_data_size > 0 || full == 0) {
+            off_t end = offset + vfi->piece_size - vfi->piece_data_size;
+            if (end > st.st_size)
+                end = st.st_size;
+            off_t start = VERIFY_ALIGN_DOWN(offset);
+            if (!(buf = verify_direct_read(fd, is_direct, start, end)))
+                goto read_error;
+            long used = verify_piece_append(vfi, buf->addr + (offset - start), end - offset);
+            verify_map_release(buf);
+            if (used == -1)
+                goto end;
+            offset = end;
+            continue;
+        }
+
+        off_t start = VERIFY_ALIGN_DOWN(offset);
+        off_t end = offset + full * vfi->piece_size;
+        if (!(buf = verify_direct_read(fd, is_direct, start, end)))
+            goto read_error;
+        for (off_t i = 0; i < full; i++) {
+            if (verify_piece_add(vfi, buf->addr + (offset - start) + i * vfi->piece_size, buf) == -1) {
+                verify_map_release(buf);
+                goto end;
+            }
+        }
+        verify_map_release(buf);
+        offset = end;
+    }
+    result = 0;
+    goto end;
+
+read_error:
+    fprintf(stderr, "Reading piece: %d failed\n", vfi->piece_index + vfi->piece_batch_count);
+end:
+    close(fd);
+    return result;
+}
+
+#ifdef IO_URING
+
+/* Don't let the pieces in flight eat all the memory either */
+#define VERIFY_URING_MAX_BYTES (256 * 1024 * 1024)
+/* The length of a read is 32 bits, larger pieces are read in parts */
+#define VERIFY_URING_MAX_READ (1024 * 1024 * 1024)
+
+/* A piece in flight */
+typedef struct {
+    int buf;
+    /* Bytes queued to be read into it, and the reads not done yet */
+    long int len;
+    int pending;
+} verify_uring_piece_t;
+
+/* A read in flight, its index is the user_data */
+typedef struct {
+    int piece;
+    int file;
+    uint8_t* dst;
+    size_t len;
+    off_t offset;
+} verify_uring_read_t;
+
+typedef struct {
+    int fd;
+    /* One for every read in flight, and one while the reader is on it */
+    int refs;
+    verify_cache_t cache;
+} verify_uring_file_t;
+
+typedef struct {
+    uring_t ring;
+    int fixed_bufs, fixed_files;
+    long int piece_size;
+
+    /* Piece buffers, they go to the batches, and come back when hashed */
+    uint8_t* buf_mem;
+    verify_map_t* bufs;
+    int* buf_free;
+    int buf_count, buf_free_count;
+
+    /* The pieces in flight in order, from the oldest one not in a batch.
+     * If filling is set, the last one is not full yet */
+    verify_uring_piece_t* pieces;
+    int depth, piece_head, piece_count;
+    int filling;
+    /* Index of the piece at the head, in the torrent */
+    int piece_index;
+
+    verify_uring_read_t* reads;
+    int* read_free;
+    int read_count, read_free_count;
+    int inflight;
+
+    verify_uring_file_t* files;
+    int file_count;
+} verify_uring_t;
+
+static verify_uring_t uring_engine;
+
+static void verify_uring_buf_release(verify_map_t* map) {
+    verify_uring_t* e = &uring_engine;
+    e->buf_free[e->buf_free_count++] = map - e->bufs;
+}
+
+static void verify_uring_destroy() {
+    verify_uring_t* e = &uring_engine;
+
+    /* The kernel may still be writing into the buffers */
+    while (e->inflight > 0 && uring_wait_cqe(&e->ring)) {
+        uring_cqe_seen(&e->ring);
+        e->inflight--;
+    }
+    for (int i = 0; e->files && i < e->file_count; i++) {
+        if (e->files[i].fd != -1) {
+            verify_cache_close(&e->files[i].cache);
+            close(e->files[i].fd);
+        }
+    }
+    uring_destroy(&e->ring);
+
+    free(e->buf_mem);
+    free(e->bufs);
+    free(e->buf_free);
+    free(e->pieces);
+    free(e->reads);
+    free(e->read_free);
+    free(e->files);
+    memset(e, 0, sizeof(*e));
+}
+
+/*
+ * Set up the ring, and buffers for the pieces in flight, plus the ones
+ * that can be in the batches at once ('batched')
+ * Returns -1 if io_uring is not available
+ */
+static int verify_uring_create(long int piece_size, int batched) {
+    verify_uring_t* e = &uring_engine;
+
+    memset(e, 0, sizeof(*e));
+    e->piece_size = piece_size;
+    e->depth = opt_queue_depth;
+    if ((long)e->depth * piece_size > VERIFY_URING_MAX_BYTES) {
+        e->depth = VERIFY_URING_MAX_BYTES / piece_size;
+        if (e->depth < 1)
+            e->depth = 1;
+    }
+    /* Pieces can span files, so allow more reads than pieces */
+    e->read_count = e->depth * 2;
+    e->file_count = e->read_count + 1;
+    e->buf_count = e->depth + batched;
+
+    if (uring_init(&e->ring, e->read_count) == -1)
+        return -1;
+
+    e->bufs = calloc(e->buf_count, sizeof(verify_map_t));
+    e->buf_free = calloc(e->buf_count, sizeof(int));
+    e->pieces = calloc(e->depth, sizeof(verify_uring_piece_t));
+    e->reads = calloc(e->read_count, sizeof(verify_uring_read_t));
+    e->read_free = calloc(e->read_count, sizeof(int));
+    e->files = calloc(e->file_count, sizeof(verify_uring_file_t));
+    if (!e->bufs || !e->buf_free || !e->pieces || !e->reads || !e->read_free || !e->files || \
+            posix_memalign((void**)&e->buf_mem, 4096, (size_t)e->buf_count * piece_size) != 0) {
+        e->buf_mem = NULL;
+        goto error;
+    }
+
+    struct iovec* iovs = calloc(e->buf_count, sizeof(struct iovec));
+    if (!iovs)
+        goto error;
+    for (int i = 0; i < e->buf_count; i++) {
+        e->bufs[i].addr = e->buf_mem + (size_t)i * piece_size;
+        e->bufs[i].len = piece_size;
+        e->bufs[i].release = verify_uring_buf_release;
+        e->buf_free[i] = i;
+        iovs[i].iov_base = e->bufs[i].addr;
+        iovs[i].iov_len = piece_size;
+    }
+    e->buf_free_count = e->buf_count;
+    /* Pinning the buffers can fail on a low memlock limit, that's fine */
+    e->fixed_bufs = uring_register_buffers(&e->ring, iovs, e->buf_count) == 0;
+    free(iovs);
+
+    int* fds = malloc(e->file_count * sizeof(int));
+    if (!fds)
+        goto error;
+    for (int i = 0; i < e->file_count; i++)
+        e->files[i].fd = fds[i] = -1;
+    e->fixed_files = uring_register_files(&e->ring, fds, e->file_count) == 0;
+    free(fds);
+
+    for (int i = 0; i < e->read_count; i++)
+        e->read_free[i] = i;
+    e->read_free_count = e->read_count;
+    return 0;
+
+error:
+    verify_uring_destroy();
+    return -1;
+}
+
+static void verify_uring_file_put(verify_uring_t* e, int file) {
+    if (--e->files[file].refs == 0) {
+        verify_cache_close(&e->files[file].cache);
+        close(e->files[file].fd);
+        e->files[file].fd = -1;
+    }
+}
+
+/*
+ * Put the read into the submission queue
+ */
+static int verify_uring_queue_read(verify_uring_t* e, int r) {
+    verify_uring_read_t* rd = &e->reads[r];
+    struct io_uring_sqe* sqe;
+
+    while (!(sqe = uring_get_sqe(&e->ring))) {
+        if (uring_submit(&e->ring, 0) == -1)
+            return -1;
+    }
+    if (e->fixed_bufs) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = e->pieces[rd->piece].buf;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+    }
+    if (e->fixed_files) {
+        sqe->fd = rd->file;
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = e->files[rd->file].fd;
+    }
+    sqe->addr = (uintptr_t)rd->dst;
+    sqe->len = rd->len;
+    sqe->off = rd->offset;
+    sqe->user_data = r;
+    return 0;
+}
+
+static void verify_uring_read_done(verify_uring_t* e, int r) {
+    e->pieces[e->reads[r].piece].pending--;
+    verify_uring_file_put(e, e->reads[r].file);
+    e->read_free[e->read_free_count++] = r;
+    e->inflight--;
+}
+
+/*
+ * Add the pieces that are read fully to the batch, in order
+ * Returns -1 if a piece didn't match
+ */
+static int verify_uring_deliver(verify_files_data_t* vfi) {
+    verify_uring_t* e = &uring_engine;
+
+    while (e->piece_count > 0) {
+        verify_uring_piece_t* p = &e->pieces[e->piece_head];
+        if (p->pending > 0 || (e->filling && e->piece_count == 1))
+            break;
+
+        verify_map_t* buf = &e->bufs[p->buf];
+        e->piece_head = (e->piece_head + 1) % e->depth;
+        e->piece_count--;
+        e->piece_index++;
+
+        int result = verify_piece_add(vfi, buf->addr, buf);
+        verify_map_release(buf);
+        if (result == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Handle the completions, waiting for one if 'wait' is set, and hand the
+ * pieces that are done to the hashing
+ * Returns -1 on error
+ */
+static int verify_uring_reap(verify_files_data_t* vfi, int wait) {
+    verify_uring_t* e = &uring_engine;
+    struct io_uring_cqe* cqe;
+    int result = 0;
+
+    if (uring_submit(&e->ring, 0) == -1) {
+        perror("io_uring submit failed");
+        return -1;
+    }
+    if (wait && e->inflight > 0) {
+        cqe = uring_wait_cqe(&e->ring);
+        if (!cqe) {
+            perror("io_uring wait failed");
+            return -1;
+        }
+    } else {
+        cqe = uring_peek_cqe(&e->ring);
+    }
+
+    for (; cqe; cqe = uring_peek_cqe(&e->ring)) {
+        int r = cqe->user_data;
+        int res = cqe->res;
+        verify_uring_read_t* rd = &e->reads[r];
+        uring_cqe_seen(&e->ring);
+
+        if (res > 0)
+            verify_cache_done(&e->files[rd->file].cache, rd->offset, rd->offset + res);
+        if (res > 0 && res < rd->len) {
+            /* Short read, queue the rest */
+            rd->dst += res;
+            rd->len -= res;
+            rd->offset += res;
+            if (verify_uring_queue_read(e, r) == 0)
+                continue;
+            res = -errno;
+        }
+        if (res <= 0) {
+            int piece = (rd->piece - e->piece_head + e->depth) % e->depth;
+            fprintf(stderr, "Reading piece: %d failed: %s\n", e->piece_index + piece, \
+                    (res) ? strerror(-res) : "File got shorter");
+            result = -1;
+        }
+        verify_uring_read_done(e, r);
+    }
+
+    if (result == -1)
+        return -1;
+    return verify_uring_deliver(vfi);
+}
+
+/*
+ * Read 'len' bytes from 'offset' of the file into the piece
+ */
+static int verify_uring_read(verify_files_data_t* vfi, verify_uring_piece_t* p, \
+        int file, off_t offset, size_t len) {
+    verify_uring_t* e = &uring_engine;
+
+    /* The reads in flight go on while this sleeps */
+    throttle_read(len);
+    /* Pick up what's done already, so the hashing keeps going */
+    if (verify_uring_reap(vfi, 0) == -1)
+        return -1;
+    while (e->read_free_count == 0) {
+        if (verify_uring_reap(vfi, 1) == -1)
+            return -1;
+    }
+
+    int r = e->read_free[--e->read_free_count];
+    verify_uring_read_t* rd = &e->reads[r];
+    rd->piece = p - e->pieces;
+    rd->file = file;
+    rd->dst = e->bufs[p->buf].addr + p->len;
+    rd->len = len;
+    rd->offset = offset;
+    if (verify_uring_queue_read(e, r) == -1) {
+        e->read_free[e->read_free_count++] = r;
+        perror("io_uring queueing failed");
+        return -1;
+    }
+    p->pending++;
+    e->files[file].refs++;
+    e->inflight++;
+    return 0;
+}
+
+/*
+ * Get the piece that is filling up, or start a new one. This waits while
+ * the queue is full
+ */
+static verify_uring_piece_t* verify_uring_piece(verify_files_data_t* vfi) {
+    verify_uring_t* e = &uring_engine;
+
+    if (e->filling)
+        return &e->pieces[(e->piece_head + e->piece_count - 1) % e->depth];
+
+    while (e->piece_count == e->depth) {
+        if (verify_uring_reap(vfi, 1) == -1)
+            return NULL;
+    }
+    /* The buffers are sized so this can't happen, but still */
+    if (e->buf_free_count == 0) {
+        fprintf(stderr, "Out of piece buffers\n");
+        return NULL;
+    }
+
+    verify_uring_piece_t* p = &e->pieces[(e->piece_head + e->piece_count) % e->depth];
+    p->buf = e->buf_free[--e->buf_free_count];
+    p->len = 0;
+    p->pending = 0;
+    e->bufs[p->buf].refs = 1;
+    e->piece_count++;
+    e->filling = 1;
+    return p;
+}
+
+/*
+ * Use a free file slot for the file
+ * Returns the slot, or -1 on error
+ */
+static int verify_uring_file_open(verify_files_data_t* vfi, int fd, off_t size) {
+    verify_uring_t* e = &uring_engine;
+
+    for (;;) {
+        for (int i = 0; i < e->file_count; i++) {
+            if (e->files[i].refs != 0)
+                continue;
+            if (e->fixed_files && uring_update_file(&e->ring, i, fd) == -1) {
+                perror("io_uring file registration failed");
+                return -1;
+            }
+            e->files[i].fd = fd;
+            e->files[i].refs = 1;
+            verify_cache_open(&e->files[i].cache, fd, size);
+            return i;
+        }
+        if (verify_uring_reap(vfi, 1) == -1)
+            return -1;
+    }
+}
+
+/*
+ * Queue the reads of the file, keeping up to queue depth pieces in
+ * flight. The reads of the previous files may still be in flight, the
+ * pieces go to the hashing in order as they complete
+ */
+static int verify_files_uring_cb(const char* path, int fd, void* data) {
+    verify_files_data_t* vfi = (verify_files_data_t*)data;
+    verify_uring_t* e = &uring_engine;
+    struct stat st;
+    int result = -1;
+
+    if (!opt_silent) {
+        vfi->file_index++;
+        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        result = (st.st_size == 0) ? 0 : -1;
+        close(fd);
+        return result;
+    }
+    int file = verify_uring_file_open(vfi, fd, st.st_size);
+    if (file == -1) {
+        close(fd);
+        return -1;
+    }
+
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        verify_uring_piece_t* p = verify_uring_piece(vfi);
+        if (!p)
+            goto end;
+
+        size_t len = e->piece_size - p->len;
+        if (len > st.st_size - offset)
+            len = st.st_size - offset;
+        if (len > VERIFY_URING_MAX_READ)
+            len = VERIFY_URING_MAX_READ;
+        if (verify_uring_read(vfi, p, file, offset, len) == -1)
+            goto end;
+        p->len += len;
+        offset += len;
+        if (p->len == e->piece_size)
+            e->filling = 0;
+    }
+    result = 0;
+
+end:
+    verify_uring_file_put(e, file);
+    return result;
+}
+
+/*
+ * Wait for the reads in flight, and batch the rest of the pieces. The last
+ * partial piece is copied to piece_data, like in the other modes
+ */
+static int verify_uring_finish(verify_files_data_t* vfi) {
+    verify_uring_t* e = &uring_engine;
+
+    while (e->inflight > 0) {
+        if (verify_uring_reap(vfi, 1) == -1)
+            return -1;
+    }
+    if (!e->filling)
+        return 0;
+
+    verify_uring_piece_t* p = &e->pieces[e->piece_head];
+    verify_map_t* buf = &e->bufs[p->buf];
+    e->filling = 0;
+    e->piece_count--;
+    long result = verify_piece_append(vfi, buf->addr, p->len);
+    verify_map_release(buf);
+    return (result == -1) ? -1 : 0;
+}
+
+#endif /* IO_URING */
+
+/*
+ * Finish the hash of the piece in the hash context, and compare it
+ * Returns 0 if it matches, -1 if not
+ */
+static int verify_piece_final(metainfo_t* m, hash_ctx_t* ctx, int piece_index) {
+    sha1sum_t result;
+    const sha1sum_t* expected;
+
+    if (metainfo_piece_index(m, piece_index, &expected) == -1) {
+        fprintf(stderr, "Piece meta hash reading failed at %d\n", piece_index);
+        return -1;
+    }
+    int res = hash_final(ctx, result);
+    throttle_cpu();
+    if (res == -1 || \
+            memcmp(result, expected, sizeof(sha1sum_t)) != 0) {
+        fprintf(stderr, "Error at piece: %d\n", piece_index);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Verify with a backend that hashes straight from the file descriptor, so
+ * the data never gets read into a piece buffer. Pieces are hashed in
+ * order, in this thread; piece_data_size counts the bytes already hashed
+ * of the current piece
+ */
+static int verify_files_fd_cb(const char* path, int fd, void* data) {
+    verify_files_data_t* vfi = (verify_files_data_t*)data;
+    verify_cache_t cache;
+    struct stat st;
+    int result = -1;
+
+    if (!opt_silent) {
+        vfi->file_index++;
+        printf("[%d/%d] Verifying file: %s\n", vfi->file_index, vfi->file_count, path);
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    verify_cache_open(&cache, fd, st.st_size);
+
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        verify_cache_advance(&cache, offset);
+        off_t len = vfi->piece_size - vfi->piece_data_size;
+        if (len > st.st_size - offset)
+            len = st.st_size - offset;
+
+        if (vfi->piece_data_size == 0 && hash_init(vfi->hash_ctx) == -1)
+            goto end;
+        throttle_read(len);
+        if (hash_update_fd(vfi->hash_ctx, fd, offset, len) == -1) {
+            fprintf(stderr, "Reading piece: %d failed\n", vfi->piece_index);
+            goto end;
+        }
+        verify_cache_done(&cache, offset, offset + len);
+        offset += len;
+        vfi->piece_data_size += len;
+
+        if (vfi->piece_data_size == vfi->piece_size) {
+            if (verify_piece_final(vfi->metai, vfi->hash_ctx, vfi->piece_index) == -1)
+                goto end;
+            vfi->piece_index++;
+            vfi->piece_data_size = 0;
+        }
+    }
+    result = 0;
+
+end:
+    verify_cache_close(&cache);
+    close(fd);
+    return result;
+}
+
+/* A file of the torrent, where its data is in the whole torrent */
+typedef struct {
+    char* path;
+    long int size;
+    long int offset;
+    /* Index of the device the file is on */
+    int device;
+    /* Opened by the preflight, or -1 */
+    int fd;
+    /* What it was like when it was opened, for --checkpoint */
+    checkpoint_file_t id;
+    /* The device of the file itself, for --skip-verified */
+    dev_t st_dev;
+    /* METAINFO_ATTR_* from the torrent */
+    int attr;
+    /* Where a symlink has to point to, NULL if it's not one */
+    char* target;
+    /* If it's verified, that's all of them without --only */
+    int selected;
+    /* If it's opened, it's selected, or it's in a selected piece */
+    int needed;
+    /* drop-if-cold: the ranges that were in the page cache before it was
+     * read, for all the workers */
+    verify_range_t* resident;
+    int resident_count;
+} verify_span_file_t;
+
+/*
+ * The span index: where the data of every piece is in the files, so any
+ * piece can be read on its own
+ */
+typedef struct {
+    verify_span_file_t* files;
+    int file_count, file_alloc;
+    /* The file every piece starts in */
+    int* piece_file;
+    int piece_count;
+    long int piece_size;
+    long int total_size;
+    /* The devices the files are on */
+    dev_t* devices;
+    int device_count;
+    /* 1 for the pieces that are all in holes, NULL if there is none */
+    uint8_t* piece_hole;
+    /* With --full, VERIFY_PIECE_* for the pieces that aren't good, 0 for
+     * the rest, NULL without --full */
+    uint8_t* piece_bad;
+    /* With --full, the files that are wrong without reading them: they
+     * have the wrong size, or they are the wrong symlink */
+    int file_mismatch;
+    /* With --only, --sample or --edges, 1 for the pieces that are
+     * verified, NULL without them */
+    uint8_t* piece_selected;
+    /* With --sample or --edges: the pieces of the selected files, the ones
+     * picked at random from them, and the ones added for the edges */
+    int sample_from, sample_random, sample_edges;
+} verify_span_t;
+
+/*
+ * Is the piece verified? Without --only, --sample and --edges they all are
+ */
+static int verify_span_selected(const verify_span_t* s, long int piece) {
+    return !s->piece_selected || s->piece_selected[piece];
+}
+
+/*
+ * Pad files and symlinks aren't read, their data is zeros
+ */
+static int verify_span_file_virtual(const verify_span_file_t* f) {
+    return (f->attr & (METAINFO_ATTR_PAD | METAINFO_ATTR_SYMLINK)) != 0;
+}
+
+static void verify_span_destroy(verify_span_t* s) {
+    for (int i = 0; i < s->file_count; i++) {
+        free(s->files[i].path);
+        free(s->files[i].target);
+        free(s->files[i].resident);
+        if (s->files[i].fd != -1)
+            close(s->files[i].fd);
+    }
+    free(s->files);
+    free(s->piece_file);
+    free(s->devices);
+    free(s->piece_hole);
+    free(s->piece_bad);
+    free(s->piece_selected);
+    memset(s, 0, sizeof(*s));
+}
+
+/*
+ * Add the device to the list if it's a new one
+ * Returns the index of the device, or -1 on error
+ */
+static int verify_span_device(verify_span_t* s, dev_t dev) {
+    for (int i = 0; i < s->device_count; i++) {
+        if (s->devices[i] == dev)
+            return i;
+    }
+    dev_t* n = realloc(s->devices, (s->device_count + 1) * sizeof(dev_t));
+    if (!n)
+        return -1;
+    s->devices = n;
+    s->devices[s->device_count] = dev;
+    return s->device_count++;
+}
+
+static int verify_span_path_cb(const char* path, const metainfo_file_t* file, void* data) {
+    verify_span_t* s = (verify_span_t*)data;
+    if (s->file_count == s->file_alloc) {
+        s->file_alloc = (s->file_alloc) ? s->file_alloc * 2 : 16;
+        verify_span_file_t* n = realloc(s->files, s->file_alloc * sizeof(verify_span_file_t));
+        if (!n)
+            return -1;
+        s->files = n;
+    }
+    verify_span_file_t* f = &s->files[s->file_count];
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+    f->size = file->size;
+    f->offset = file->offset;
+    f->attr = file->attr;
+    if (!(f->path = strdup(path)))
+        return -1;
+    f->selected = opts_only_file(file->path, s->file_count);
+    f->needed = 1;
+    s->file_count++;
+
+    /* The target is relative to the torrent folder, that's the full path
+     * without the file's own part */
+    if (file->symlink_path) {
+        size_t root_len = strlen(path) - file->path_len;
+        if (!(f->target = malloc(root_len + file->symlink_path_len + 1)))
+            return -1;
+        memcpy(f->target, path, root_len);
+        memcpy(f->target + root_len, file->symlink_path, file->symlink_path_len + 1);
+    }
+    return 0;
+}
+
+/*
+ * Check that the symlink is there, and points to the same file as its
+ * target. A target that isn't there is fine, if the link doesn't resolve
+ * either
+ * Returns 0 if it's right, an errno if it can't be checked, or -1
+ */
+static int verify_span_symlink(const verify_span_file_t* f) {
+    struct stat link_st, target_st;
+    if (lstat(f->path, &link_st) == -1)
+        return errno;
+    if (!S_ISLNK(link_st.st_mode)) {
+        fprintf(stderr, "%s is not a symlink\n", f->path);
+        return -1;
+    }
+    int link_res = stat(f->path, &link_st);
+    int target_res = stat(f->target, &target_st);
+    if (link_res != target_res || (link_res == 0 && \
+                (link_st.st_dev != target_st.st_dev || link_st.st_ino != target_st.st_ino))) {
+        fprintf(stderr, "%s doesn't link to %s\n", f->path, f->target);
+        return -1;
+    }
+    return 0;
+}
+
+/* Ask for the extents of a file this many at once */
+#define VERIFY_FIEMAP_EXTENTS 256
+
+typedef struct {
+    verify_range_t* ranges;
+    int count, size;
+} verify_ranges_t;
+
+static int verify_ranges_add(verify_ranges_t* r, off_t start, off_t end) {
+    if (r->count == r->size) {
+        r->size = (r->size) ? r->size * 2 : 16;
+        verify_range_t* n = realloc(r->ranges, r->size * sizeof(verify_range_t));
+        if (!n)
+            return -1;
+        r->ranges = n;
+    }
+    r->ranges[r->count].start = start;
+    r->ranges[r->count++].end = end;
+    return 0;
+}
+
+static int verify_range_cmp(const void* a, const void* b) {
+    off_t sa = ((const verify_range_t*)a)->start;
+    off_t sb = ((const verify_range_t*)b)->start;
+    return (sa > sb) - (sa < sb);
+}
+
+/*
+ * Add the ranges of a file that read as zeros without being on the disk,
+ * to 'r', in torrent offsets: the holes, and the unwritten extents that
+ * are allocated, but were never written. Filesystems that can't tell
+ * have no such ranges
+ * Returns 0 on success, -1 on error
+ */
+static int verify_span_file_holes(const verify_span_file_t* f, int fd, verify_ranges_t* r) {
+    int result = 0;
+
+    for (off_t pos = 0; pos < f->size && result == 0;) {
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data == -1 && errno != ENXIO)
+            break;
+        /* ENXIO: it's a hole until the end */
+        if (data == -1 || data > f->size)
+            data = f->size;
+        if (data > pos)
+            result = verify_ranges_add(r, f->offset + pos, f->offset + data);
+        if (data == f->size)
+            break;
+        if ((pos = lseek(fd, data, SEEK_HOLE)) == -1)
+            break;
+    }
+
+    /* Sync, so the dirty pages in unwritten extents are written first */
+    struct fiemap* fm = malloc(sizeof(struct fiemap) + \
+            VERIFY_FIEMAP_EXTENTS * sizeof(struct fiemap_extent));
+    for (uint64_t start = 0; fm && result == 0 && start < (uint64_t)f->size;) {
+        memset(fm, 0, sizeof(struct fiemap));
+        fm->fm_start = start;
+        fm->fm_length = f->size - start;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = VERIFY_FIEMAP_EXTENTS;
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) == -1 || fm->fm_mapped_extents == 0)
+            break;
+
+        struct fiemap_extent* last = NULL;
+        for (unsigned i = 0; i < fm->fm_mapped_extents && result == 0; i++) {
+            last = &fm->fm_extents[i];
+            if (!(last->fe_flags & FIEMAP_EXTENT_UNWRITTEN))
+                continue;
+            uint64_t end = last->fe_logical + last->fe_length;
+            if (end > (uint64_t)f->size)
+                end = f->size;
+            result = verify_ranges_add(r, f->offset + last->fe_logical, f->offset + end);
+        }
+        if (last->fe_flags & FIEMAP_EXTENT_LAST)
+            break;
+        start = last->fe_logical + last->fe_length;
+    }
+    free(fm);
+    /* The file is read from here next, by the engines that don't pread */
+    lseek(fd, 0, SEEK_SET);
+    return result;
+}
+
+/*
+ * Mark the pieces that are all in the ranges 'r' of holes, they are zeros
+ * without reading them. Incomplete downloads are often preallocated
+ * sparse files
+ * Returns 0 on success, -1 on error
+ */
+static int verify_span_holes(verify_span_t* s, verify_ranges_t* r) {
+    if (r->count == 0)
+        return 0;
+    if (!(s->piece_hole = calloc(s->piece_count, 1)))
+        return -1;
+
+    /* A piece can be in more ranges, of more files, that are next to each other */
+    qsort(r->ranges, r->count, sizeof(verify_range_t), verify_range_cmp);
+    for (int i = 0; i < r->count;) {
+        off_t start = r->ranges[i].start, end = r->ranges[i].end;
+        for (i++; i < r->count && r->ranges[i].start <= end; i++) {
+            if (r->ranges[i].end > end)
+                end = r->ranges[i].end;
+        }
+
+        long int piece = (start + s->piece_size - 1) / s->piece_size;
+        for (; piece < s->piece_count; piece++) {
+            long int piece_end = (piece + 1) * s->piece_size;
+            if (piece_end > s->total_size)
+                piece_end = s->total_size;
+            if (piece_end > end)
+                break;
+            s->piece_hole[piece] = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Mark the pieces that 'f' is in, a bad mark overrides the others. The
+ * ones that aren't selected stay unmarked
+ */
+static void verify_span_mark(verify_span_t* s, const verify_span_file_t* f, uint8_t mark) {
+    for (long int p = f->offset / s->piece_size; \
+            p < s->piece_count && p * s->piece_size < f->offset + f->size; p++) {
+        if (!verify_span_selected(s, p))
+            continue;
+        if (!s->piece_bad[p] || mark == VERIFY_PIECE_BAD)
+            s->piece_bad[p] = mark;
+    }
+}
+
+/* Files opened at once by the preflight */
+#define VERIFY_PREFLIGHT_DEPTH 64
+/* File descriptors left for everything else */
+#define VERIFY_FD_RESERVE 64
+
+/* What the preflight found out about a file */
+typedef struct {
+    /* The size is in this too */
+    checkpoint_file_t id;
+    /* Where the data is, and the device of the file itself, they are
+     * different on mergerfs */
+    dev_t device, st_dev;
+    mode_t mode;
+    /* The errno if it can't be opened, or 0 */
+    int error;
+} verify_preflight_t;
+
+typedef struct {
+    verify_span_t* span;
+    verify_preflight_t* results;
+    /* The holes of the files, NULL if they aren't needed */
+    verify_ranges_t* holes;
+    int hole_error;
+    /* The files before this keep their descriptors for reading */
+    int keep;
+    /* The next file to open, for the threads. The pad files, symlinks and
+     * the files that aren't needed are skipped */
+    int next;
+#ifdef MT
+    pthread_mutex_t mut;
+#endif
+} verify_preflight_data_t;
+
+/*
+ * How many files can be left open, after raising the soft limit as far
+ * as it goes
+ */
+static int verify_fd_budget() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return 0;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rlim_t cur = rl.rlim_cur;
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            rl.rlim_cur = cur;
+    }
+    long int budget = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX) ? \
+                      INT_MAX : (long int)rl.rlim_cur;
+    budget -= VERIFY_FD_RESERVE + VERIFY_PREFLIGHT_DEPTH;
+    return (budget > 0) ? budget : 0;
+}
+
+/*
+ * Record what's known about an opened file, find its holes if its size is
+ * right, and keep, or close the descriptor. On mergerfs every file is on
+ * the same FUSE device, so it's asked which branch the file is really on
+ */
+static void verify_preflight_file(verify_preflight_data_t* pd, int i, int fd, \
+        const verify_preflight_t* found) {
+    verify_span_file_t* f = &pd->span->files[i];
+    char base[PATH_MAX];
+    struct stat base_st;
+
+    pd->results[i] = *found;
+    pd->results[i].st_dev = found->device;
+    ssize_t len = fgetxattr(fd, "user.mergerfs.basepath", base, sizeof(base) - 1);
+    if (len > 0) {
+        base[len] = '\0';
+        if (stat(base, &base_st) == 0)
+            pd->results[i].device = base_st.st_dev;
+    }
+
+    long int size = found->id.size;
+    if (pd->holes && size == f->size && size > 0) {
+        verify_ranges_t r = {0};
+        int res = verify_span_file_holes(f, fd, &r);
+#ifdef MT
+        pthread_mutex_lock(&pd->mut);
+#endif
+        for (int j = 0; j < r.count && res == 0; j++)
+            res = verify_ranges_add(pd->holes, r.ranges[j].start, r.ranges[j].end);
+        if (res == -1)
+            pd->hole_error = 1;
+#ifdef MT
+        pthread_mutex_unlock(&pd->mut);
+#endif
+        free(r.ranges);
+    }
+    /* Once, before the workers read anything of it */
+    if (opt_cache == OPT_CACHE_DROP_IF_COLD && size > 0)
+        verify_cache_scan(fd, size, &f->resident, &f->resident_count);
+
+    if (i < pd->keep)
+        f->fd = fd;
+    else
+        close(fd);
+}
+
+/*
+ * Take the next file that has to be opened
+ * Returns its index, or file_count if there is none left
+ */
+static int verify_preflight_next(verify_preflight_data_t* pd) {
+    const verify_span_t* s = pd->span;
+    while (pd->next < s->file_count && (verify_span_file_virtual(&s->files[pd->next]) || \
+                !s->files[pd->next].needed))
+        pd->next++;
+    return (pd->next < s->file_count) ? pd->next++ : s->file_count;
+}
+
+/*
+ * Open and stat the files, until there is none left
+ */
+static void* verify_preflight_worker(void* param) {
+    verify_preflight_data_t* pd = (verify_preflight_data_t*)param;
+    struct stat st;
+
+    for (;;) {
+#ifdef MT
+        pthread_mutex_lock(&pd->mut);
+#endif
+        int i = verify_preflight_next(pd);
+#ifdef MT
+        pthread_mutex_unlock(&pd->mut);
+#endif
+        if (i >= pd->span->file_count)
+            break;
+
+        int fd = open(pd->span->files[i].path, O_RDONLY);
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            pd->results[i].error = errno;
+            if (fd != -1)
+                close(fd);
+            continue;
+        }
+        verify_preflight_t found = {
+            .id = { .size = st.st_size, .inode = st.st_ino, \
+                .mtime_sec = st.st_mtim.tv_sec, .mtime_nsec = st.st_mtim.tv_nsec },
+            .device = st.st_dev,
+            .mode = st.st_mode,
+        };
+        verify_preflight_file(pd, i, fd, &found);
+    }
+    return NULL;
+}
+
+#ifdef IO_URING
+
+/* A file being opened, and then stat-ed */
+typedef struct {
+    int file;
+    /* If a request of it is in flight */
+    int pending;
+    int fd;
+    int error;
+    struct statx stx;
+} verify_preflight_slot_t;
+
+/*
+ * Open and stat every file with io_uring, keeping up to
+ * VERIFY_PREFLIGHT_DEPTH files in flight. The stat is of the descriptor
+ * once it's open, not the path again, that may be another file by then.
+ * The user data of a request is the slot * 2, +1 for the stat
+ * Returns 0 on success, or -1 if io_uring can't do it, then nothing is done
+ */
+static int verify_preflight_uring(verify_preflight_data_t* pd) {
+    verify_span_t* s = pd->span;
+    verify_preflight_slot_t slots[VERIFY_PREFLIGHT_DEPTH];
+    int slot_count = (s->file_count < VERIFY_PREFLIGHT_DEPTH) ? \
+                     s->file_count : VERIFY_PREFLIGHT_DEPTH;
+    int inflight = 0, unsupported = 0;
+    uring_t ring;
+
+    if (uring_init(&ring, slot_count) == -1)
+        return -1;
+    for (int i = 0; i < slot_count; i++)
+        slots[i].pending = 0;
+
+    for (;;) {
+        for (int i = 0; i < slot_count && !unsupported; i++) {
+            verify_preflight_slot_t* slot = &slots[i];
+            if (slot->pending)
+                continue;
+            if ((slot->file = verify_preflight_next(pd)) == s->file_count)
+                break;
+            slot->fd = -1;
+            slot->error = 0;
+            slot->pending = 1;
+
+            struct io_uring_sqe* sqe = uring_get_sqe(&ring);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)s->files[slot->file].path;
+            sqe->open_flags = O_RDONLY;
+            sqe->user_data = i * 2;
+            inflight++;
+        }
+        if (inflight == 0)
+            break;
+
+        struct io_uring_cqe* cqe = uring_wait_cqe(&ring);
+        if (!cqe) {
+            /* The requests may still be in flight, with pointers into the stack */
+            perror("io_uring wait failed");
+            exit(EXIT_FAILURE);
+        }
+        for (; cqe; cqe = uring_peek_cqe(&ring)) {
+            int index = cqe->user_data / 2;
+            verify_preflight_slot_t* slot = &slots[index];
+            int res = cqe->res, opened = (cqe->user_data % 2 == 0 && res >= 0);
+            if (opened)
+                slot->fd = res;
+            else if (res < 0)
+                slot->error = -res;
+            /* Kernels that don't have these requests fail them */
+            if (res == -EINVAL)
+                unsupported = 1;
+            uring_cqe_seen(&ring);
+            inflight--;
+
+            if (opened && !unsupported) {
+                /* There is room, a slot has one request at a time */
+                static const char empty[] = "";
+                struct io_uring_sqe* sqe = uring_get_sqe(&ring);
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = slot->fd;
+                sqe->addr = (uintptr_t)empty;
+                sqe->statx_flags = AT_EMPTY_PATH;
+                sqe->len = STATX_SIZE | STATX_INO | STATX_MTIME | STATX_MODE;
+                sqe->off = (uintptr_t)&slot->stx;
+                sqe->user_data = index * 2 + 1;
+                inflight++;
+                continue;
+            }
+            slot->pending = 0;
+            if (slot->error || unsupported) {
+                pd->results[slot->file].error = slot->error;
+                if (slot->fd != -1)
+                    close(slot->fd);
+                continue;
+            }
+            const struct statx* stx = &slot->stx;
+            verify_preflight_t found = {
+                .id = { .size = stx->stx_size, .inode = stx->stx_ino, \
+                    .mtime_sec = stx->stx_mtime.tv_sec, .mtime_nsec = stx->stx_mtime.tv_nsec },
+                .device = makedev(stx->stx_dev_major, stx->stx_dev_minor),
+                .mode = stx->stx_mode,
+            };
+            verify_preflight_file(pd, slot->file, slot->fd, &found);
+        }
+    }
+    uring_destroy(&ring);
+
+    if (unsupported) {
+        /* Start over, without io_uring */
+        for (int i = 0; i < s->file_count; i++) {
+            if (s->files[i].fd != -1)
+                close(s->files[i].fd);
+            s->files[i].fd = -1;
+            free(s->files[i].resident);
+            s->files[i].resident = NULL;
+            s->files[i].resident_count = 0;
+        }
+        memset(pd->results, 0, s->file_count * sizeof(verify_preflight_t));
+        if (pd->holes)
+            pd->holes->count = 0;
+        pd->hole_error = 0;
+        pd->next = 0;
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* IO_URING */
+
+/*
+ * Open and stat all the files at once, instead of one after the other:
+ * on network filesystems, and with many small files, that's where the
+ * time goes. It's done with io_uring if the kernel can, or with threads.
+ * The files keep their descriptors for reading, as long as there are
+ * enough descriptors for them
+ */
+static void verify_preflight(verify_preflight_data_t* pd) {
+    int file_count = pd->span->file_count;
+
+    pd->keep = verify_fd_budget();
+    if (file_count <= 1) {
+        verify_preflight_worker(pd);
+        return;
+    }
+#ifdef IO_URING
+    if (verify_preflight_uring(pd) == 0)
+        return;
+#endif
+#ifdef MT
+    int thread_count = (file_count < VERIFY_PREFLIGHT_DEPTH) ? \
+                       file_count : VERIFY_PREFLIGHT_DEPTH;
+    pthread_t* threads = calloc(thread_count, sizeof(pthread_t));
+    pthread_mutex_init(&pd->mut, NULL);
+
+    int started = 0;
+    for (; threads && started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, verify_preflight_worker, pd) != 0)
+            break;
+    }
+    /* Do the work here too, if there is no thread at all */
+    if (started == 0)
+        verify_preflight_worker(pd);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&pd->mut);
+    free(threads);
+#else
+    verify_preflight_worker(pd);
+#endif
+}
+
+/* -ln(0.05): with no bad piece in n random ones, less than this / n of
+ * them are bad, with 95% confidence. It's the rule of three */
+#define VERIFY_SAMPLE_CONFIDENCE 2.995732
+
+/*
+ * The next number of a splitmix64 generator, it's good enough to pick
+ * pieces, and the same seed gives the same ones everywhere
+ */
+static uint64_t verify_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Pick opt_sample percent of the selected pieces at random, every set of
+ * them is just as likely, and add the first and last piece of every
+ * selected file with --edges
+ * Returns 0 on success, -1 on error
+ */
+static int verify_span_sample(verify_span_t* s) {
+    uint8_t* picked = calloc(s->piece_count + 1, 1);
+    if (!picked) {
+        fprintf(stderr, "Can't allocate the piece list\n");
+        return -1;
+    }
+
+    for (int i = 0; i < s->piece_count; i++)
+        s->sample_from += s->piece_selected[i];
+    if (opt_sample > 0) {
+        uint64_t seed = (opt_seed >= 0) ? (uint64_t)opt_seed : \
+                        (uint64_t)(time(NULL) ^ ((long int)getpid() << 16)) % LONG_MAX;
+        uint64_t state = seed;
+        if (!opt_silent)
+            printf("Sample seed: %lu\n", (unsigned long)seed);
+
+        /* Go through them once, a piece is picked with the chance of
+         * the ones still needed out of the ones left */
+        long int want = (long int)(s->sample_from * opt_sample / 100);
+        if (want < s->sample_from * opt_sample / 100)
+            want++;
+        long int left = s->sample_from;
+        for (int i = 0; i < s->piece_count && want > 0; i++) {
+            if (!s->piece_selected[i])
+                continue;
+            if ((long int)(verify_random(&state) % left) < want) {
+                picked[i] = 1;
+                s->sample_random++;
+                want--;
+            }
+            left--;
+        }
+    }
+
+    for (int i = 0; opt_edges && i < s->file_count; i++) {
+        const verify_span_file_t* f = &s->files[i];
+        if (!f->selected || f->size == 0 || verify_span_file_virtual(f))
+            continue;
+        long int edges[2] = { f->offset / s->piece_size, \
+            (f->offset + f->size - 1) / s->piece_size };
+        for (int j = 0; j < 2; j++) {
+            if (!picked[edges[j]]) {
+                picked[edges[j]] = 1;
+                s->sample_edges++;
+            }
+        }
+    }
+
+    free(s->piece_selected);
+    s->piece_selected = picked;
+    return 0;
+}
+
+/*
+ * Select the pieces that the files of --only and --only-index are in,
+ * and then the ones of --sample and --edges from them. The files next to
+ * them are only needed for the bytes in those pieces, the rest aren't
+ * opened at all
+ * Returns 0 on success, -1 on error
+ */
+static int verify_span_select(verify_span_t* s) {
+    int selected = 0;
+
+    if (!opt_only && opt_only_index < 0 && opt_sample == 0 && !opt_edges)
+        return 0;
+    if (!(s->piece_selected = calloc(s->piece_count + 1, 1))) {
+        fprintf(stderr, "Can't allocate the piece list\n");
+        return -1;
+    }
+    for (int i = 0; i < s->file_count; i++) {
+        const verify_span_file_t* f = &s->files[i];
+        if (!f->selected)
+            continue;
+        selected++;
+        for (long int p = f->offset / s->piece_size; \
+                p < s->piece_count && p * s->piece_size < f->offset + f->size; p++)
+            s->piece_selected[p] = 1;
+    }
+    if (selected == 0) {
+        fprintf(stderr, "No file is selected by --only or --only-index\n");
+        return -1;
+    }
+    if ((opt_sample > 0 || opt_edges) && verify_span_sample(s) == -1)
+        return -1;
+
+    /* The empty ones are only checked to be there */
+    for (int i = 0; i < s->file_count; i++) {
+        verify_span_file_t* f = &s->files[i];
+        f->needed = f->selected && f->size == 0;
+        for (long int p = f->offset / s->piece_size; !f->needed && \
+                p < s->piece_count && p * s->piece_size < f->offset + f->size; p++)
+            f->needed = s->piece_selected[p];
+    }
+    return 0;
+}
+
+/*
+ * Build the span index of the torrent. The files have to be as large as
+ * the torrent says, otherwise the pieces would be in other places, so a
+ * file with the wrong size fails the piece it starts in, without reading
+ * anything. With --full, all the pieces it's in are marked bad instead.
+ * The pad files and symlinks aren't opened, their data is zeros, like in
+ * a hole; a symlink only has to point to the right file. With --only,
+ * the files that have no data in the selected pieces aren't opened.
+ * The holes are only looked for if 'want_holes'
+ * Returns 0 on success, an errno if a file can't be opened, or -1
+ */
+static int verify_span_create(verify_span_t* s, metainfo_t* m, \
+        const char* data_dir, int append_torrent_folder, int want_holes) {
+    verify_preflight_data_t pd = {0};
+    verify_ranges_t holes = {0};
+    int result = -1;
+
+    memset(s, 0, sizeof(*s));
+    if (verify_fullpath_iter(m, data_dir, append_torrent_folder, \
+                verify_span_path_cb, s) != 0) {
+        fprintf(stderr, "Can't allocate the file list\n");
+        goto error;
+    }
+
+    if (s->file_count > 0) {
+        const verify_span_file_t* last = &s->files[s->file_count - 1];
+        s->total_size = last->offset + last->size;
+    }
+
+    s->piece_size = metainfo_piece_size(m);
+    s->piece_count = metainfo_piece_count(m);
+    if (s->piece_size <= 0 || s->piece_count != \
+            (s->total_size + s->piece_size - 1) / s->piece_size) {
+        fprintf(stderr, "The piece count doesn't match the size of the files\n");
+        goto error;
+    }
+    if (verify_span_select(s) == -1)
+        goto error;
+
+    pd.span = s;
+    pd.holes = (want_holes) ? &holes : NULL;
+    if (!(pd.results = calloc(s->file_count, sizeof(verify_preflight_t)))) {
+        fprintf(stderr, "Can't allocate the file list\n");
+        goto error;
+    }
+    verify_preflight(&pd);
+
+    if (opt_full && !(s->piece_bad = calloc(s->piece_count + 1, 1))) {
+        fprintf(stderr, "Can't allocate the piece list\n");
+        goto error;
+    }
+    for (int i = 0; i < s->file_count; i++) {
+        verify_span_file_t* f = &s->files[i];
+        int error = pd.results[i].error;
+        f->device = -1;
+        f->id = pd.results[i].id;
+        f->st_dev = pd.results[i].st_dev;
+        if (!f->needed)
+            continue;
+        if (verify_span_file_virtual(f)) {
+            /* Only the symlink itself can be wrong, the data is zeros */
+            f->id.size = f->size;
+            if (f->target && (error = verify_span_symlink(f)) == -1) {
+                if (!s->piece_bad)
+                    goto error;
+                s->file_mismatch++;
+                verify_span_mark(s, f, VERIFY_PIECE_BAD);
+                error = 0;
+            }
+            if (error == 0 && pd.holes && f->size > 0 && \
+                    verify_ranges_add(pd.holes, f->offset, f->offset + f->size) == -1)
+                pd.hole_error = 1;
+        }
+        if (opt_partial && (error == ENOENT || error == ENOTDIR)) {
+            f->id.size = -1;
+            if (!opt_silent)
+                printf("Missing file: %s\n", f->path);
+            verify_span_mark(s, f, VERIFY_PIECE_MISSING);
+            continue;
+        }
+        if (error) {
+            fprintf(stderr, "%s: %s\n", f->path, strerror(error));
+            result = error;
+            goto error;
+        }
+        if (f->id.size != f->size && s->piece_bad) {
+            fprintf(stderr, "The size of %s is %ld, not %ld\n", \
+                    f->path, f->id.size, f->size);
+            s->file_mismatch++;
+            verify_span_mark(s, f, VERIFY_PIECE_BAD);
+        } else if (f->id.size != f->size) {
+            long int piece = f->offset / s->piece_size;
+            if (piece >= s->piece_count)
+                piece = (s->piece_count > 0) ? s->piece_count - 1 : 0;
+            fprintf(stderr, "Error at piece: %ld, the size of %s is %ld, not %ld\n", \
+                    piece, f->path, f->id.size, f->size);
+            goto error;
+        }
+        if (verify_span_file_virtual(f))
+            continue;
+        /* The data is still right, it's only told */
+        if ((f->attr & METAINFO_ATTR_EXEC) && !(pd.results[i].mode & 0111))
+            fprintf(stderr, "%s is not executable\n", f->path);
+        if ((f->device = verify_span_device(s, pd.results[i].device)) == -1) {
+            fprintf(stderr, "Can't allocate the device list\n");
+            goto error;
+        }
+    }
+
+    /* The missing, pad files and symlinks are never read, but their pieces
+     * are handed out by device too, they go with the file before them */
+    if (s->device_count == 0 && verify_span_device(s, 0) == -1) {
+        fprintf(stderr, "Can't allocate the device list\n");
+        goto error;
+    }
+    for (int i = 0, device = 0; i < s->file_count; i++) {
+        if (s->files[i].device == -1)
+            s->files[i].device = device;
+        device = s->files[i].device;
+    }
+
+    s->piece_file = malloc(s->piece_count * sizeof(int));
+    if (!s->piece_file && s->piece_count > 0) {
+        fprintf(stderr, "Can't allocate the span index\n");
+        goto error;
+    }
+    /* The span files are the file table of the torrent, in the same order */
+    for (int i = 0; i < s->piece_count; i++)
+        s->piece_file[i] = metainfo_file_at(m, (long int)i * s->piece_size);
+
+    if (pd.hole_error || verify_span_holes(s, &holes) == -1) {
+        fprintf(stderr, "Can't allocate the hole map\n");
+        goto error;
+    }
+    free(pd.results);
+    free(holes.ranges);
+    return 0;
+
+error:
+    free(pd.results);
+    free(holes.ranges);
+    verify_span_destroy(s);
+    return result;
+}
+
+/*
+ * Give every file to the callback in order, with the descriptor the
+ * preflight kept, or a newly opened one. The callback closes it
+ * Returns 0, or what the callback returned if that's not 0
+ */
+static int verify_span_iter(verify_span_t* s, verify_file_cb cb, void* data) {
+    for (int i = 0; i < s->file_count; i++) {
+        verify_span_file_t* f = &s->files[i];
+        int fd = f->fd;
+        f->fd = -1;
+        if (fd == -1 && (fd = open(f->path, O_RDONLY)) == -1) {
+            perror(f->path);
+            return -1;
+        }
+        int result = cb(f->path, fd, data);
+        if (result != 0)
+            return result;
+    }
+    return 0;
+}
+
+/* A worker's open file */
+typedef struct {
+    int file;
+    int fd;
+    /* If the fd is the worker's, and not the one the span index has */
+    int owned;
+    verify_cache_t cache;
+} verify_span_reader_t;
+
+static void verify_span_reader_close(verify_span_reader_t* r) {
+    if (r->fd != -1) {
+        verify_cache_close(&r->cache);
+        if (r->owned)
+            close(r->fd);
+    }
+    r->file = -1;
+    r->fd = -1;
+}
+
+/*
+ * Only the last piece can be shorter
+ */
+static long int verify_span_piece_size(const verify_span_t* s, int piece) {
+    long int start = (long int)piece * s->piece_size;
+    return (s->total_size - start < s->piece_size) ? s->total_size - start : s->piece_size;
+}
+
+/*
+ * Read a piece at 'buf', through the span index
+ * Returns the size of the piece, or -1 on error
+ */
+static long int verify_span_read(const verify_span_t* s, verify_span_reader_t* r, \
+        int piece, uint8_t* buf) {
+    long int start = (long int)piece * s->piece_size;
+    long int end = start + verify_span_piece_size(s, piece);
+
+    for (int i = s->piece_file[piece]; start < end; i++) {
+        const verify_span_file_t* f = &s->files[i];
+        if (f->offset + f->size <= start)
+            continue;
+        long int len = ((f->offset + f->size < end) ? f->offset + f->size : end) - start;
+        off_t offset = start - f->offset;
+
+        if (verify_span_file_virtual(f)) {
+            memset(buf, 0, len);
+            start += len;
+            buf += len;
+            continue;
+        }
+        if (r->file != i) {
+            verify_span_reader_close(r);
+            /* pread doesn't move the offset, the workers can share it */
+            r->owned = (f->fd == -1);
+            r->fd = (r->owned) ? open(f->path, O_RDONLY) : f->fd;
+            if (r->fd == -1) {
+                perror(f->path);
+                return -1;
+            }
+            r->file = i;
+            verify_cache_open_shared(&r->cache, r->fd, f->size, f->resident, \
+                    f->resident_count);
+        }
+        for (long int done = 0; done < len;) {
+            ssize_t n = pread(r->fd, buf + done, len - done, offset + done);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                /* The file got shorter since it was checked */
+                if (n == 0)
+                    errno = EIO;
+                return -1;
+            }
+            done += n;
+        }
+        verify_cache_done(&r->cache, offset, offset + len);
+        throttle_read(len);
+        start += len;
+        buf += len;
+    }
+    return end - (long int)piece * s->piece_size;
+}
+
+typedef struct {
+    metainfo_t* metai;
+    verify_span_t* span;
+    int batch_size;
+    /* The next piece to verify on every device, pieces are handed out in
+     * batches of the ones that start on the device */
+    int* device_next;
+    /* Workers are spread over the devices in the order they start */
+    int worker_next;
+    /* The first piece that didn't match, or piece_count */
+    int bad_piece;
+    int result;
+    /* The files that were reported as started, for the progress */
+    char* file_printed;
+    /* With --checkpoint, 1 for the pieces that are checked, NULL otherwise */
+    uint8_t* done;
+    checkpoint_file_t* ids;
+    /* When to write the checkpoint next, and if it's being written now */
+    double checkpoint_next;
+    int checkpoint_busy;
+#ifdef MT
+    pthread_mutex_t mut;
+#endif
+} verify_pread_data_t;
+
+/* Write --checkpoint this often, in seconds */
+#define VERIFY_CHECKPOINT_INTERVAL 5
+
+static double verify_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Copy what's checked so far into 'c', for --checkpoint. The pieces that
+ * are marked bad are only looked at after they are checked, then the
+ * worker that checked them is done with them. If there are workers, the
+ * mutex has to be locked
+ * Returns 0 on success, -1 on error
+ */
+static int verify_pread_snapshot(verify_pread_data_t* vd, checkpoint_t* c) {
+    const verify_span_t* s = vd->span;
+
+    memset(c, 0, sizeof(*c));
+    c->info_hash = (const unsigned char*)metainfo_infohash(vd->metai);
+    c->piece_count = s->piece_count;
+    c->files = vd->ids;
+    c->file_count = s->file_count;
+    c->done = malloc(s->piece_count + 1);
+    c->bad = calloc(s->piece_count + 1, 1);
+    if (!c->done || !c->bad) {
+        fprintf(stderr, "Can't allocate the checkpoint\n");
+        free(c->done);
+        free(c->bad);
+        return -1;
+    }
+
+    memcpy(c->done, vd->done, s->piece_count);
+    for (int i = 0; s->piece_bad && i < s->piece_count; i++)
+        c->bad[i] = c->done[i] && s->piece_bad[i] == VERIFY_PIECE_BAD;
+    if (vd->bad_piece < s->piece_count)
+        c->done[vd->bad_piece] = c->bad[vd->bad_piece] = 1;
+    return 0;
+}
+
+/*
+ * Set up --checkpoint, and take the results from it, if it's of the same
+ * files
+ * Returns 0 on success, -1 on error
+ */
+static int verify_pread_resume(verify_pread_data_t* vd) {
+    verify_span_t* s = vd->span;
+    checkpoint_t c = {0};
+    int result = -1;
+
+    vd->done = calloc(s->piece_count + 1, 1);
+    vd->ids = malloc((s->file_count + 1) * sizeof(checkpoint_file_t));
+    c.bad = calloc(s->piece_count + 1, 1);
+    if (!vd->done || !vd->ids || !c.bad) {
+        fprintf(stderr, "Can't allocate the checkpoint\n");
+        goto end;
+    }
+    for (int i = 0; i < s->file_count; i++)
+        vd->ids[i] = s->files[i].id;
+
+    c.info_hash = (const unsigned char*)metainfo_infohash(vd->metai);
+    c.piece_count = s->piece_count;
+    c.files = vd->ids;
+    c.file_count = s->file_count;
+    c.done = vd->done;
+    int loaded = checkpoint_load(opt_checkpoint, &c);
+    if (loaded == -1)
+        goto end;
+
+    int done_count = 0;
+    for (int i = 0; loaded && i < s->piece_count; i++) {
+        done_count += vd->done[i];
+        if (!c.bad[i])
+            continue;
+        if (s->piece_bad)
+            s->piece_bad[i] = VERIFY_PIECE_BAD;
+        else if (i < vd->bad_piece)
+            vd->bad_piece = i;
+    }
+    if (loaded && !opt_silent)
+        printf("Going on from %s, %d of %d pieces are checked\n", \
+                opt_checkpoint, done_count, s->piece_count);
+    vd->checkpoint_next = verify_clock() + VERIFY_CHECKPOINT_INTERVAL;
+    result = 0;
+
+end:
+    free(c.bad);
+    return result;
+}
+
+/*
+ * The record of a file in the database of verified files
+ */
+static void verify_verified_file(const verify_pread_data_t* vd, int index, \
+        verified_file_t* out) {
+    const verify_span_file_t* f = &vd->span->files[index];
+
+    memset(out, 0, sizeof(*out));
+    memcpy(out->info_hash, metainfo_infohash(vd->metai), sizeof(out->info_hash));
+    out->file_index = index;
+    out->device = f->st_dev;
+    out->inode = f->id.inode;
+    out->size = f->id.size;
+    out->mtime_sec = f->id.mtime_sec;
+    out->mtime_nsec = f->id.mtime_nsec;
+}
+
+/*
+ * Mark the pieces as checked, that are all in files that didn't change
+ * since they were verified, unless it's --recheck. If the database can't
+ * be read, everything is verified
+ * Returns 0 on success, -1 on error
+ */
+static int verify_pread_skip_verified(verify_pread_data_t* vd) {
+    const verify_span_t* s = vd->span;
+    verified_file_t rec;
+    int skipped = 0;
+
+    if (!vd->done && !(vd->done = calloc(s->piece_count + 1, 1))) {
+        fprintf(stderr, "Can't allocate the piece list\n");
+        return -1;
+    }
+    if (opt_recheck || verified_open() == -1)
+        return 0;
+
+    uint8_t* known = calloc(s->file_count + 1, 1);
+    if (!known) {
+        fprintf(stderr, "Can't allocate the file list\n");
+        return -1;
+    }
+    for (int i = 0; i < s->file_count; i++) {
+        if (s->files[i].size > 0 && s->files[i].id.size == s->files[i].size) {
+            verify_verified_file(vd, i, &rec);
+            known[i] = verified_has(&rec);
+        }
+    }
+
+    for (int i = 0; i < s->piece_count; i++) {
+        long int end = (long int)i * s->piece_size + verify_span_piece_size(s, i);
+        /* A piece of only pad and empty files isn't vouched for by any
+         * file that was verified, it's hashed */
+        int all = 1, any = 0;
+        for (int j = s->piece_file[i]; all && j < s->file_count && s->files[j].offset < end; j++) {
+            int is_virtual = (s->files[j].size == 0 || verify_span_file_virtual(&s->files[j]));
+            all = (is_virtual || known[j]);
+            any |= (!is_virtual && known[j]);
+        }
+        if (all && any && !vd->done[i]) {
+            vd->done[i] = 1;
+            skipped++;
+        }
+    }
+    if (skipped > 0 && !opt_silent)
+        printf("Skipping %d of %d pieces, their files didn't change since they were verified\n", \
+                skipped, s->piece_count);
+    free(known);
+    return 0;
+}
+
+/*
+ * Add the files to the database of verified files, that all the pieces
+ * they are in are good, and mark the ones that are in a bad piece as bad.
+ * Bitrot doesn't change the mtime, the old record would still match them
+ */
+static void verify_pread_remember(verify_pread_data_t* vd) {
+    const verify_span_t* s = vd->span;
+    int good_count = 0, bad_count = 0;
+
+    verified_file_t* good = malloc((s->file_count + 1) * sizeof(verified_file_t));
+    verified_file_t* bad = malloc((s->file_count + 1) * sizeof(verified_file_t));
+    if (!good || !bad || verified_open() == -1)
+        goto end;
+    for (int i = 0; i < s->file_count; i++) {
+        const verify_span_file_t* f = &s->files[i];
+        if (f->size == 0 || f->id.size != f->size || verify_span_file_virtual(f))
+            continue;
+        int all_good = 1, any_bad = 0;
+        for (long int p = f->offset / s->piece_size; !any_bad && p < s->piece_count && \
+                p * s->piece_size < f->offset + f->size; p++) {
+            any_bad = (s->piece_bad && s->piece_bad[p] == VERIFY_PIECE_BAD) || \
+                p == vd->bad_piece;
+            all_good &= vd->done[p] && !(s->piece_bad && s->piece_bad[p]);
+        }
+        if (any_bad)
+            verify_verified_file(vd, i, &bad[bad_count++]);
+        else if (all_good)
+            verify_verified_file(vd, i, &good[good_count++]);
+    }
+    verified_remove(bad, bad_count);
+    verified_add(good, good_count);
+
+end:
+    free(good);
+    free(bad);
+}
+
+/*
+ * Mark the pieces as checked for --checkpoint, and write it if it's time.
+ * It's written outside of the lock, the others don't wait for the disk
+ */
+static void verify_pread_done(verify_pread_data_t* vd, int first, int count) {
+    checkpoint_t c;
+    if (!vd->done)
+        return;
+
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    memset(vd->done + first, 1, count);
+    double now = verify_clock();
+    int save = opt_checkpoint && !vd->checkpoint_busy && now >= vd->checkpoint_next && \
+               verify_pread_snapshot(vd, &c) == 0;
+    if (save) {
+        vd->checkpoint_busy = 1;
+        vd->checkpoint_next = now + VERIFY_CHECKPOINT_INTERVAL;
+    }
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+    if (!save)
+        return;
+
+    checkpoint_save(opt_checkpoint, &c);
+    free(c.done);
+    free(c.bad);
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    vd->checkpoint_busy = 0;
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+}
+
+/*
+ * Take the next batch of pieces from 'device', or if it has none left,
+ * from the next device that has. Returns 0 if there is nothing left to
+ * do. Nothing after a bad piece is taken, so it's always the first bad
+ * piece that's reported. The pieces a checkpoint has, and the ones that
+ * aren't selected are skipped
+ */
+static int verify_pread_take(verify_pread_data_t* vd, int device, int* first) {
+    const verify_span_t* s = vd->span;
+    int count = 0;
+
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    int end = (vd->bad_piece < s->piece_count) ? vd->bad_piece : s->piece_count;
+    for (int i = 0; vd->result == 0 && count == 0 && i < s->device_count; i++) {
+        int d = (device + i) % s->device_count;
+        int* next = &vd->device_next[d];
+        while (*next < end && (s->files[s->piece_file[*next]].device != d || \
+                    (vd->done && vd->done[*next]) || !verify_span_selected(s, *next)))
+            (*next)++;
+        *first = *next;
+        while (count < vd->batch_size && *next < end && \
+                s->files[s->piece_file[*next]].device == d && \
+                !(vd->done && vd->done[*next]) && verify_span_selected(s, *next)) {
+            (*next)++;
+            count++;
+        }
+    }
+
+    if (count > 0 && vd->file_printed) {
+        /* Report the files the batch is in, empty ones at the end too */
+        long int end_byte = (long int)(*first + count) * s->piece_size;
+        for (int i = (*first) ? s->piece_file[*first] : 0; i < s->file_count && \
+                (s->files[i].offset < end_byte || end_byte >= s->total_size); i++) {
+            /* The pad files aren't there to be verified, the ones next to
+             * the selected files are only read a bit of */
+            if (!vd->file_printed[i] && s->files[i].selected && \
+                    !(s->files[i].attr & METAINFO_ATTR_PAD)) {
+                vd->file_printed[i] = 1;
+                printf("[%d/%d] Verifying file: %s\n", i + 1, s->file_count, s->files[i].path);
+            }
+        }
+    }
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+    return count;
+}
+
+static void verify_pread_bad(verify_pread_data_t* vd, int piece, int is_error) {
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    if (is_error)
+        vd->result = -1;
+    else if (piece < vd->bad_piece)
+        vd->bad_piece = piece;
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+}
+
+/*
+ * Read and hash batches of pieces, until there is none left, or one fails
+ */
+static void* verify_pread_worker(void* param) {
+    verify_pread_data_t* vd = (verify_pread_data_t*)param;
+    const verify_span_t* s = vd->span;
+    uint8_t* pieces[HASH_MAX_LANES] = {0};
+    verify_span_reader_t reader = { .file = -1, .fd = -1 };
+    int first, count;
+
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    int device = vd->worker_next++ % s->device_count;
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+
+    hash_ctx_t* ctx = hash_ctx_new();
+    if (!ctx) {
+        fprintf(stderr, "Hash context creation failed\n");
+        verify_pread_bad(vd, 0, 1);
+        return NULL;
+    }
+    for (int i = 0; i < vd->batch_size; i++) {
+        if (!(pieces[i] = malloc(s->piece_size))) {
+            fprintf(stderr, "Can't allocate piece buffer\n");
+            verify_pread_bad(vd, 0, 1);
+            goto end;
+        }
+    }
+
+    while ((count = verify_pread_take(vd, device, &first)) > 0) {
+        long int size = 0;
+        int i;
+        for (i = 0; i < count; i++) {
+            /* It's known to be bad, what's in the buffer doesn't matter */
+            if (s->piece_bad && s->piece_bad[first + i]) {
+                size = verify_span_piece_size(s, first + i);
+                continue;
+            }
+            if ((size = verify_span_read(s, &reader, first + i, pieces[i])) == -1) {
+                fprintf(stderr, "Reading piece: %d failed: %s\n", first + i, strerror(errno));
+                if (!s->piece_bad) {
+                    verify_pread_bad(vd, first + i, 1);
+                    goto end;
+                }
+                /* With --full, it has to be downloaded again too */
+                s->piece_bad[first + i] = VERIFY_PIECE_BAD;
+                size = verify_span_piece_size(s, first + i);
+            }
+        }
+
+        /* Only the last piece can be shorter, it's hashed on its own */
+        int full = (size == s->piece_size) ? count : count - 1;
+        const sha1sum_t* expected;
+        if (metainfo_piece_index(vd->metai, first, &expected) == -1) {
+            fprintf(stderr, "Piece meta hash reading failed at %d\n", first);
+            verify_pread_bad(vd, first, 1);
+            break;
+        }
+        uint8_t* marks = (s->piece_bad) ? s->piece_bad + first : NULL;
+        int bad = (full > 0) ? verify_piece_batch_hash(ctx, \
+                (const uint8_t* const*)pieces, full, s->piece_size, expected, marks) : -1;
+        if (bad == -1 && full < count)
+            bad = (verify_piece_batch_hash(ctx, (const uint8_t* const*)&pieces[full], \
+                        1, size, expected + full, (marks) ? marks + full : NULL) == -1) ? -1 : full;
+        if (bad != -1)
+            verify_pread_bad(vd, first + bad, 0);
+        /* Without --full, the ones after a bad piece weren't compared */
+        verify_pread_done(vd, first, (bad == -1) ? count : bad);
+    }
+
+end:
+    verify_span_reader_close(&reader);
+    for (int i = 0; i < vd->batch_size; i++)
+        free(pieces[i]);
+    hash_ctx_free(ctx);
+    return NULL;
+}
+
+/*
+ * Check the pieces that are all in holes, against the hash of zeros. The
+ * ones that match are marked in 'done', the workers don't take them
+ * Returns the first one that doesn't match, piece_count if they all do,
+ * or -1 on error. With --full, the ones that don't match are marked bad,
+ * and it goes on
+ */
+static int verify_pread_holes(metainfo_t* m, const verify_span_t* s, uint8_t* done) {
+    const sha1sum_t* expected;
+    sha1sum_t zero;
+    int result = s->piece_count;
+
+    hash_ctx_t* ctx = hash_ctx_new();
+    if (!ctx) {
+        fprintf(stderr, "Hash context creation failed\n");
+        return -1;
+    }
+    for (int i = 0; i < s->piece_count; i++) {
+        if (!s->piece_hole[i] || done[i] || !verify_span_selected(s, i))
+            continue;
+        if (metainfo_piece_index(m, i, &expected) == -1 || \
+                verify_zero_hash(ctx, NULL, verify_span_piece_size(s, i), zero) == -1) {
+            fprintf(stderr, "Can't check the piece in a hole: %d\n", i);
+            result = -1;
+            break;
+        }
+        if (memcmp(zero, expected, sizeof(sha1sum_t)) != 0) {
+            if (s->piece_bad) {
+                s->piece_bad[i] = VERIFY_PIECE_BAD;
+                continue;
+            }
+            result = i;
+            break;
+        }
+        done[i] = 1;
+    }
+    hash_ctx_free(ctx);
+    return result;
+}
+
+/*
+ * Write the bad pieces to 'path', a bit for every piece, from the highest
+ * bit of the first byte, like the BitTorrent bitfield, but 1 is bad
+ * Returns 0 on success, -1 on error
+ */
+static int verify_write_bitfield(const verify_span_t* s, const char* path) {
+    size_t len = (s->piece_count + 7) / 8;
+    uint8_t* bits = calloc(len + 1, 1);
+    if (!bits) {
+        fprintf(stderr, "Can't allocate the bitfield\n");
+        return -1;
+    }
+    for (int i = 0; i < s->piece_count; i++) {
+        if (s->piece_bad[i])
+            bits[i / 8] |= 0x80 >> (i % 8);
+    }
+
+    int result = -1;
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        result = (fwrite(bits, 1, len, f) == len) ? 0 : -1;
+        if (fclose(f) != 0)
+            result = -1;
+    }
+    if (result == -1)
+        perror(path);
+    free(bits);
+    return result;
+}
+
+/*
+ * List the bad pieces of --full, and the bytes of the files that are in
+ * them, that's what has to be downloaded again. With --partial, the pieces
+ * that can't be verified are listed too
+ * Returns 0 if every piece, and file is good, or only missing, -1 if not
+ */
+static int verify_full_report(const verify_span_t* s) {
+    int bad_count = 0, missing_count = 0, selected_count = 0;
+
+    for (int i = 0; i < s->piece_count; i++)
+        selected_count += verify_span_selected(s, i);
+    for (int i = 0; i < s->piece_count;) {
+        uint8_t mark = s->piece_bad[i];
+        if (!mark) {
+            i++;
+            continue;
+        }
+        int first = i;
+        while (i < s->piece_count && s->piece_bad[i] == mark)
+            i++;
+        if (mark == VERIFY_PIECE_MISSING) {
+            missing_count += i - first;
+            if (!opt_silent && i - first == 1)
+                printf("Can't verify piece: %d\n", first);
+            else if (!opt_silent)
+                printf("Can't verify pieces: %d-%d\n", first, i - 1);
+            continue;
+        }
+
+        bad_count += i - first;
+        if (i - first == 1)
+            fprintf(stderr, "Error at piece: %d\n", first);
+        else
+            fprintf(stderr, "Error at pieces: %d-%d\n", first, i - 1);
+
+        long int start = (long int)first * s->piece_size;
+        long int end = (long int)i * s->piece_size;
+        if (end > s->total_size)
+            end = s->total_size;
+        for (int j = s->piece_file[first]; j < s->file_count && s->files[j].offset < end; j++) {
+            const verify_span_file_t* f = &s->files[j];
+            long int file_start = (f->offset > start) ? f->offset : start;
+            long int file_end = (f->offset + f->size < end) ? f->offset + f->size : end;
+            if (file_start < file_end && !verify_span_file_virtual(f))
+                fprintf(stderr, "Bad bytes in %s: %ld-%ld\n", f->path, \
+                        file_start - f->offset, file_end - f->offset - 1);
+        }
+    }
+    if (opt_partial && !opt_silent)
+        printf("Pieces: %d verified, %d bad, %d can't be verified\n", \
+                selected_count - bad_count - missing_count, bad_count, missing_count);
+    else if (bad_count > 0)
+        fprintf(stderr, "Bad pieces: %d of %d\n", bad_count, selected_count);
+
+    if (opt_bitfield && verify_write_bitfield(s, opt_bitfield) == -1)
+        return -1;
+    return (bad_count > 0 || s->file_mismatch > 0) ? -1 : 0;
+}
+
+/*
+ * Tell how much of the torrent --sample and --edges verified, and if no
+ * bad piece was found in the random ones, how many can still be bad
+ */
+static void verify_sample_report(const verify_span_t* s) {
+    int checked = s->sample_random + s->sample_edges;
+    printf("Checked %d of %d pieces (%.1f%%), %d at random, %d at the edges of the files\n", \
+            checked, s->sample_from, 100.0 * checked / s->sample_from, \
+            s->sample_random, s->sample_edges);
+    if (s->sample_random > 0) {
+        double bound = 100.0 * VERIFY_SAMPLE_CONFIDENCE / s->sample_random;
+        printf("With 95%% confidence, less than %.3g%% of the pieces are bad\n", \
+                (bound < 100) ? bound : 100);
+    }
+}
+
+/*
+ * Verify with every thread reading its own pieces, with pread, through
+ * the span index. Nothing is read in order, so there is no reader that
+ * the hashing waits on. Every device gets its own readers, so the disks
+ * are read at the same time; a piece that's on more than one of them is
+ * read whole by the reader of the device it starts on.
+ * This destroys the span index.
+ * Returns 0 if all files match
+ */
+static int verify_files_pread(metainfo_t* m, verify_span_t* span, \
+        int batch_size, int thread_count) {
+    verify_pread_data_t data = {0};
+    data.metai = m;
+    data.span = span;
+    data.batch_size = batch_size;
+    data.bad_piece = span->piece_count;
+    data.device_next = calloc(span->device_count, sizeof(int));
+    if (!opt_silent)
+        data.file_printed = calloc(span->file_count, 1);
+    if (!data.device_next || (!opt_silent && !data.file_printed && span->file_count > 0)) {
+        fprintf(stderr, "Can't allocate the device list\n");
+        data.result = -1;
+        goto end;
+    }
+    if ((opt_checkpoint && verify_pread_resume(&data) == -1) || \
+            (opt_skip_verified && verify_pread_skip_verified(&data) == -1)) {
+        data.result = -1;
+        goto end;
+    }
+
+    /* A hole where there should be data fails it without reading anything */
+    if (span->piece_hole) {
+        if (!data.done && !(data.done = calloc(span->piece_count + 1, 1))) {
+            fprintf(stderr, "Can't allocate the piece list\n");
+            data.result = -1;
+            goto end;
+        }
+        int bad = verify_pread_holes(m, span, data.done);
+        if (bad == -1 || bad < span->piece_count) {
+            if (bad != -1)
+                fprintf(stderr, "Error at piece: %d, it's in a hole\n", bad);
+            data.result = -1;
+            goto end;
+        }
+    }
+
+#ifdef MT
+    /* Reading is what takes time on disks, not the hashing */
+    if (thread_count < span->device_count)
+        thread_count = span->device_count;
+    if (thread_count > span->piece_count)
+        thread_count = span->piece_count;
+    pthread_t* threads = calloc(thread_count, sizeof(pthread_t));
+    pthread_mutex_init(&data.mut, NULL);
+
+    int started = 0;
+    for (; threads && started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, verify_pread_worker, &data) != 0) {
+            perror("Thread creation failed: ");
+            break;
+        }
+    }
+    /* Do the work here too, if there is no thread at all */
+    if (started == 0)
+        verify_pread_worker(&data);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&data.mut);
+    free(threads);
+#else
+    verify_pread_worker(&data);
+#endif
+
+    if (opt_skip_verified && data.done)
+        verify_pread_remember(&data);
+    if (data.done && opt_checkpoint) {
+        /* After an error, the next run can go on from here, otherwise
+         * it's done */
+        checkpoint_t c;
+        if (data.result == -1 && verify_pread_snapshot(&data, &c) == 0) {
+            checkpoint_save(opt_checkpoint, &c);
+            free(c.done);
+            free(c.bad);
+        } else if (data.result == 0 && unlink(opt_checkpoint) == -1 && errno != ENOENT) {
+            perror(opt_checkpoint);
+        }
+    }
+
+    if (data.result == 0 && data.bad_piece < span->piece_count) {
+        fprintf(stderr, "Error at piece: %d\n", data.bad_piece);
+        data.result = -1;
+    }
+    if (data.result == 0 && span->piece_bad)
+        data.result = verify_full_report(span);
+    if (data.result == 0 && span->sample_from > 0 && !opt_silent)
+        verify_sample_report(span);
+
+end:
+    free(data.device_next);
+    free(data.file_printed);
+    free(data.done);
+    free(data.ids);
+    verify_span_destroy(span);
+    return data.result;
+}
+
+/*
+ * Does the torrent have pad files, or symlinks (BEP 47)? They aren't on
+ * the disk, only the span index knows about them
+ */
+static int verify_has_virtual_files(metainfo_t* m) {
+    const metainfo_file_t* files;
+    int file_count = metainfo_file_table(m, &files);
+
+    for (int i = 0; i < file_count; i++) {
+        if (files[i].attr & (METAINFO_ATTR_PAD | METAINFO_ATTR_SYMLINK))
+            return 1;
+    }
+    return 0;
+}
+
+/* Let the writer of the pipe get this far ahead of the reader */
+#define VERIFY_STREAM_PIPE_SIZE (1024 * 1024)
+
+/*
+ * Add 'len' bytes from the stream to the piece that's being assembled, or
+ * zeros if 'fd' is -1, and batch the pieces that are full
+ * Returns the bytes that are missing if the stream ended early, 0 if it
+ * didn't, or -1 on error, or if a piece didn't match
+ */
+static long int verify_stream_fill(verify_files_data_t* vfi, int fd, long int len) {
+    while (len > 0) {
+        uint8_t** buf = &vfi->piece_data[vfi->piece_batch_count];
+        if (!*buf && !(*buf = malloc(vfi->piece_size))) {
+            fprintf(stderr, "Can't allocate piece buffer\n");
+            return -1;
+        }
+
+        long int n = vfi->piece_size - vfi->piece_data_size;
+        if (n > len)
+            n = len;
+        if (fd == -1) {
+            memset(*buf + vfi->piece_data_size, 0, n);
+        } else {
+            ssize_t r = read(fd, *buf + vfi->piece_data_size, n);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r == -1) {
+                fprintf(stderr, "Reading piece: %d failed: %s\n", \
+                        vfi->piece_index + vfi->piece_batch_count, strerror(errno));
+                return -1;
+            }
+            if (r == 0)
+                return len;
+            throttle_read(r);
+            n = r;
+        }
+        vfi->piece_data_size += n;
+        len -= n;
+
+        if (vfi->piece_data_size == vfi->piece_size && verify_piece_add(vfi, *buf, NULL) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read the data of the torrent from 'fd', the files one after the other,
+ * like verify_span_iter reads them from the disk. The file sizes in the
+ * torrent tell where a file ends. Pad files and symlinks aren't in the
+ * stream, they are zeros
+ * Returns 0 if the stream is as long as the files, -1 if not, or on error
+ */
+static int verify_stream_iter(metainfo_t* m, int fd, verify_files_data_t* vfi) {
+    const metainfo_file_t* files;
+    int file_count = metainfo_file_table(m, &files);
+    long int total_size = 0;
+
+    if (file_count > 0)
+        total_size = files[file_count - 1].offset + files[file_count - 1].size;
+    if (vfi->piece_size <= 0 || metainfo_piece_count(m) != \
+            (total_size + vfi->piece_size - 1) / vfi->piece_size) {
+        fprintf(stderr, "The piece count doesn't match the size of the files\n");
+        return -1;
+    }
+    /* Fails if it's not a pipe, or the limit is lower, that's fine */
+    fcntl(fd, F_SETPIPE_SZ, VERIFY_STREAM_PIPE_SIZE);
+
+    for (int i = 0; i < file_count; i++) {
+        const metainfo_file_t* f = &files[i];
+        int is_virtual = f->attr & (METAINFO_ATTR_PAD | METAINFO_ATTR_SYMLINK);
+        if (!opt_silent && !is_virtual)
+            printf("[%d/%d] Verifying file: %.*s\n", i + 1, file_count, f->path_len, f->path);
+
+        long int missing = verify_stream_fill(vfi, (is_virtual) ? -1 : fd, f->size);
+        if (missing == -1)
+            return -1;
+        if (missing > 0) {
+            fprintf(stderr, "The data ended %ld bytes before the end of: %.*s\n", \
+                    missing, f->path_len, f->path);
+            return -1;
+        }
+    }
+
+    char extra;
+    ssize_t r;
+    while ((r = read(fd, &extra, 1)) == -1 && errno == EINTR)
+        ;
+    if (r > 0) {
+        fprintf(stderr, "There is more data after the last file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Verify the files in 'data_dir', or the data from stdin if it's "-"
+ * Returns 0 if all files match
+ */
+static int verify_files(metainfo_t* m, const char* data_dir, \
+        int append_torrent_folder) {
+    int result = 0;
+    long int piece_size = metainfo_piece_size(m);
+    /* With -v -, the data comes from stdin in order, there are no files
+     * to read the pieces from on their own */
+    int stream = (strcmp(data_dir, "-") == 0);
+    /* If the backend can hash from the files, there is nothing to read.
+     * --full, --checkpoint, --skip-verified, --only, --sample, --edges,
+     * and torrents with pad files read every piece on its own, with
+     * pread. With pad files, the files start on piece boundaries, so
+     * every piece is only in one of them. With -v -, none of these are
+     * possible, the pieces are hashed as they come */
+    int span_only = !stream && (opt_full || opt_checkpoint || opt_skip_verified || \
+                    opt_only || opt_only_index >= 0 || opt_sample > 0 || opt_edges || \
+                    verify_has_virtual_files(m));
+    int zero_copy = hash_can_update_fd() && !span_only && !stream;
+
+    int batch_size = hash_lanes();
+    if ((long)batch_size * piece_size > VERIFY_BATCH_MAX_BYTES) {
+        batch_size = VERIFY_BATCH_MAX_BYTES / piece_size;
+        if (batch_size < 1)
+            batch_size = 1;
+    }
+    if (zero_copy)
+        batch_size = 0;
+
+    /* The zero copy path hashes in order, in the kernel, no threads needed */
+#ifdef MT
+    int thread_count = (zero_copy) ? 0 : get_nprocs_conf();
+#else
+    int thread_count = 0;
+#endif
+
+    /* The files are opened here, the engines read them from the span index */
+    int can_pread = span_only || (!zero_copy && !opt_direct && \
+                    (opt_io == OPT_IO_PREAD || opt_io == OPT_IO_AUTO));
+    verify_span_t span;
+    if (stream) {
+        memset(&span, 0, sizeof(span));
+    } else {
+        int span_res = verify_span_create(&span, m, data_dir, append_torrent_folder, can_pread);
+        if (span_res != 0)
+            return span_res;
+        /* With more than one thread, or disk, they read for themselves.
+         * Holes are only skipped with the span index */
+        if (can_pread && (span_only || opt_io == OPT_IO_PREAD || thread_count > 1 || \
+                    span.device_count > 1 || span.piece_hole))
+            return verify_files_pread(m, &span, batch_size, thread_count);
+    }
+
+    enum OPT_IO io = (opt_io == OPT_IO_MMAP) ? OPT_IO_MMAP : OPT_IO_STDIO;
+#ifdef IO_URING
+    if (!zero_copy && !opt_direct && !stream && (opt_io == OPT_IO_AUTO || opt_io == OPT_IO_URING)) {
+        if (verify_uring_create(piece_size, batch_size * (thread_count + 1)) == 0)
+            io = OPT_IO_URING;
+        else if (opt_io == OPT_IO_URING)
+            fprintf(stderr, "io_uring is not available (%s), using stdio\n", strerror(errno));
+    }
+#endif
+    /* Only stdio and the stream read into the buffers, the rest allocate
+     * when needed */
+    int prealloc = ((io == OPT_IO_STDIO && !opt_direct) || stream) ? batch_size : 0;
+    if (opt_direct) {
+        long chunk_pieces = VERIFY_DIRECT_CHUNK / piece_size;
+        direct_pool.buf_size = ((chunk_pieces > 1) ? chunk_pieces : 1) * piece_size + \
+                               2 * VERIFY_DIRECT_ALIGN;
+    }
+
+#if MT
+    mt_max_thread = thread_count;
+    pthread_mutex_init(&mt_mut_tofill, 0);
+    sem_init(&mt_sem_needs_fill, 0, 0);
+    pthread_cond_init(&mt_cond_tofill, 0);
+    mt_threads = calloc(mt_max_thread, sizeof(verify_thread_t));
+    for (int i = 0; i < mt_max_thread; i++) {
+        for (int j = 0; j < prealloc; j++)
+            mt_threads[i].thread_data.piece_data[j] = malloc(piece_size);
+        mt_threads[i].thread_data.hash_ctx = hash_ctx_new();
+        if (!mt_threads[i].thread_data.hash_ctx) {
+            fprintf(stderr, "Hash context creation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        sem_init(&mt_threads[i].thread_data.sem_filled_buffer, 0, 0);
+        if (pthread_create(&mt_threads[i].thread, NULL, verify_piece_hash_mt, &mt_threads[i].thread_data) != 0) {
+            perror("Thread creation failed: ");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+
+    verify_files_data_t data = {0};
+    data.piece_size = piece_size;
+    data.piece_batch_size = batch_size;
+    for (int i = 0; i < prealloc; i++)
+        data.piece_data[i] = malloc(piece_size);
+    data.piece_batch_count = 0;
+    data.piece_data_size = 0;
+    data.piece_index = 0;
+    data.metai = m;
+    data.hash_ctx = hash_ctx_new();
+    if (!data.hash_ctx) {
+        fprintf(stderr, "Hash context creation failed\n");
+        result = -1;
+        goto end;
+    }
+
+    if (!opt_silent) {
+        data.file_count = span.file_count;
+        data.file_index = 0;
+    }
+
+    verify_file_cb read_cb = verify_files_cb;
+    if (zero_copy)
+        read_cb = verify_files_fd_cb;
+    else if (opt_direct)
+        read_cb = verify_files_direct_cb;
+    else if (io == OPT_IO_MMAP)
+        read_cb = verify_files_mmap_cb;
+#ifdef IO_URING
+    else if (io == OPT_IO_URING)
+        read_cb = verify_files_uring_cb;
+#endif
+
+    int vres = (stream) ? verify_stream_iter(m, STDIN_FILENO, &data) : \
+               verify_span_iter(&span, read_cb, &data);
+    if (vres != 0) {
+        result = vres;
+        goto end;
+    }
+
+#ifdef IO_URING
+    if (io == OPT_IO_URING && verify_uring_finish(&data) == -1) {
+        result = -1;
+        goto end;
+    }
+#endif
+
+#ifdef MT
+    /* Check what the threads are still working on */
+    if (verify_mt_drain() == -1) {
+        result = -1;
+        goto end;
+    }
+#endif
+
+    /* Here, we may still have some full pieces, and the last partial one */
+    const uint8_t* last_piece = data.piece_data[data.piece_batch_count];
+    if (data.piece_batch_count > 0) {
+        if (verify_piece_batch(m, data.hash_ctx, data.piece_ptr, \
+                    data.piece_batch_count, piece_size, data.piece_index) == -1) {
+            result = -1;
+            goto end;
+        }
+        data.piece_index += data.piece_batch_count;
+    }
+
+    if (data.piece_data_size > 0) {
+        int piece_res = (zero_copy) ? \
+            verify_piece_final(m, data.hash_ctx, data.piece_index) : \
+            verify_piece_batch(m, data.hash_ctx, &last_piece, 1, \
+                    data.piece_data_size, data.piece_index);
+        if (piece_res == -1) {
+            result = -1;
+            goto end;
+        }
+        data.piece_index++;
+    }
+
+    /* If the data ended early on a piece boundary, nothing failed so far */
+    if (data.piece_index != metainfo_piece_count(m)) {
+        fprintf(stderr, "Data ended at piece: %d\n", data.piece_index);
+        result = -1;
+        goto end;
     }
 
 end:
@@ -458,21 +3528,79 @@ end:
 
         sem_destroy(&mt_threads[i].thread_data.sem_filled_buffer);
 
-        free(mt_threads[i].thread_data.piece_data);
+        verify_batch_release(mt_threads[i].thread_data.piece_map, \
+                mt_threads[i].thread_data.piece_count);
+        for (int j = 0; j < batch_size; j++)
+            free(mt_threads[i].thread_data.piece_data[j]);
+        hash_ctx_free(mt_threads[i].thread_data.hash_ctx);
     }
     free(mt_threads);
     pthread_cond_destroy(&mt_cond_tofill);
     pthread_mutex_destroy(&mt_mut_tofill);
     sem_destroy(&mt_sem_needs_fill);
 #endif
-    free(data.piece_data);
+    verify_batch_release(data.piece_map, data.piece_batch_count);
+    for (int i = 0; i < batch_size; i++)
+        free(data.piece_data[i]);
+    if (data.hash_ctx)
+        hash_ctx_free(data.hash_ctx);
+#ifdef IO_URING
+    /* After the batches, they give the buffers back to it */
+    if (io == OPT_IO_URING)
+        verify_uring_destroy();
+#endif
+    verify_direct_pool_destroy();
+    verify_span_destroy(&span);
     return result;
 }
 
+/*
+ * The option that needs the results of the v1 pieces, or NULL. A hybrid
+ * torrent is verified with its v1 pieces then, a v2 only one can't be
+ */
+static const char* verify_v1_option() {
+    if (opt_bitfield)
+        return "bitfield";
+    if (opt_partial)
+        return "partial";
+    if (opt_full)
+        return "full";
+    if (opt_checkpoint)
+        return "checkpoint";
+    return NULL;
+}
+
 int verify(metainfo_t* metai, const char* data_dir, int append_folder) {
-    int files_no_exists = verify_is_files_exists(metai, data_dir, append_folder);
-    if (files_no_exists)
-        return files_no_exists;
-    
+    throttle_init();
+    hash_backend_resolve();
+
+    /* The stream is hashed with the v1 pieces, a hybrid has those too */
+    if (strcmp(data_dir, "-") == 0) {
+        if (metainfo_piece_count(metai) == 0) {
+            fprintf(stderr, "A v2 only torrent can't be verified from stdin\n");
+            return -1;
+        }
+        return verify_files(metai, data_dir, append_folder);
+    }
+
+    /* v2 has per file hash trees, hybrids are verified with those too */
+    if (metainfo_is_v2(metai)) {
+        const char* v1_option = verify_v1_option();
+        if (v1_option && metainfo_piece_count(metai) > 0)
+            return verify_files(metai, data_dir, append_folder);
+        if (v1_option) {
+            fprintf(stderr, "--%s can't be used with a v2 only torrent\n", v1_option);
+            return -1;
+        }
+        /* Skipping needs the v1 pieces, without them everything is verified */
+        if (opt_skip_verified && metainfo_piece_count(metai) > 0)
+            return verify_files(metai, data_dir, append_folder);
+        if (opt_skip_verified && !opt_silent)
+            printf("--skip-verified and --recheck are only for v1 and hybrid torrents, all the files are verified\n");
+        if ((opt_sample > 0 || opt_edges) && !opt_silent)
+            printf("--sample and --edges are only for v1 torrents, all the pieces are verified\n");
+        return verify_v2(metai, data_dir, append_folder);
+    }
+
     return verify_files(metai, data_dir, append_folder);
 }
@@ -7,6 +7,7 @@
  * Verify files inside a torrent file
  * If append folder is 1, and torrent is a multifile one,
  * the torrent's name will be appended to data_dir
+ * If data_dir is "-", the data of the files is read from stdin
  * Returns 0 if success, -num if error
  */
 int verify(metainfo_t* metai, const char* data_dir, int append_folder);
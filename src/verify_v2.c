@@ -0,0 +1,398 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "verify_v2.h"
+#include "sha256.h"
+#include "opts.h"
+#include "throttle.h"
+
+#ifdef MT
+#include <sys/sysinfo.h>
+#include <pthread.h>
+#endif
+
+/* The leaves of the hash trees are the hashes of 16 KiB blocks */
+#define VERIFY_V2_BLOCK_SIZE (16 * 1024)
+
+typedef struct {
+    char* path;
+    long int size;
+    /* NULL if the file is empty */
+    const sha256sum_t* pieces_root;
+    /* NULL if the file is not larger than a piece */
+    const sha256sum_t* layer;
+    int layer_count;
+} verify_v2_file_t;
+
+typedef struct {
+    metainfo_t* metai;
+    verify_v2_file_t* files;
+    int file_count;
+    /* The next file to verify, and the number of the ones started */
+    int file_next;
+    int result;
+#ifdef MT
+    pthread_mutex_t mut;
+#endif
+} verify_v2_data_t;
+
+/* Per thread buffers */
+typedef struct {
+    uint8_t* piece;
+    /* The block hashes of a piece */
+    sha256sum_t* leaves;
+    /* The piece hashes of a file */
+    sha256sum_t* pieces;
+    long int pieces_size;
+} verify_v2_buffers_t;
+
+/*
+ * Hash the concatenation of 2 nodes
+ */
+static void verify_v2_hash_pair(const sha256sum_t left, const sha256sum_t right, \
+        sha256sum_t out) {
+    unsigned char pair[2 * sizeof(sha256sum_t)];
+    memcpy(pair, left, sizeof(sha256sum_t));
+    memcpy(pair + sizeof(sha256sum_t), right, sizeof(sha256sum_t));
+    sha256(pair, sizeof(pair), out);
+}
+
+/*
+ * Reduce 'count' nodes in place to the root of a tree 'width' wide,
+ * which is a power of 2. The missing nodes on the bottom layer are 'pad'.
+ */
+static void verify_v2_merkle_root(sha256sum_t* nodes, long int count, \
+        long int width, const sha256sum_t pad, sha256sum_t root) {
+    sha256sum_t pad_curr;
+    memcpy(pad_curr, pad, sizeof(sha256sum_t));
+
+    for (; width > 1; width /= 2) {
+        for (long int i = 0; 2 * i < count; i++)
+            verify_v2_hash_pair(nodes[2 * i], \
+                    (2 * i + 1 < count) ? nodes[2 * i + 1] : pad_curr, nodes[i]);
+        count = (count + 1) / 2;
+        verify_v2_hash_pair(pad_curr, pad_curr, pad_curr);
+    }
+    memcpy(root, nodes[0], sizeof(sha256sum_t));
+}
+
+static long int verify_v2_pow2(long int n) {
+    long int p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
+
+/*
+ * Read until 'len' bytes, or the end of the file
+ * Returns the bytes read, or -1 on error
+ */
+static long int verify_v2_read(int fd, uint8_t* buf, long int len) {
+    long int done = 0;
+    while (done < len) {
+        ssize_t r = read(fd, buf + done, len - done);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+/*
+ * Verify a whole file against its pieces root, and its piece layer
+ * Returns 0 if it matches, -1 if not
+ */
+static int verify_v2_file(metainfo_t* m, verify_v2_file_t* f, verify_v2_buffers_t* buf) {
+    static const sha256sum_t zero = {0};
+    long int piece_size = metainfo_piece_size(m);
+    long int blocks_per_piece = piece_size / VERIFY_V2_BLOCK_SIZE;
+    long int piece_count = (f->size + piece_size - 1) / piece_size;
+    int result = -1;
+    uint8_t extra;
+
+    int fd = open(f->path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Can't open %s: %s\n", f->path, strerror(errno));
+        return -1;
+    }
+
+    if (piece_count > 1 && f->layer_count != piece_count) {
+        fprintf(stderr, "Piece layer is missing, or it's invalid for: %s\n", f->path);
+        goto end;
+    }
+    if (piece_count > buf->pieces_size) {
+        sha256sum_t* pieces = realloc(buf->pieces, piece_count * sizeof(sha256sum_t));
+        if (!pieces)
+            goto end;
+        buf->pieces = pieces;
+        buf->pieces_size = piece_count;
+    }
+
+    for (long int p = 0; p < piece_count; p++) {
+        long int len = f->size - p * piece_size;
+        if (len > piece_size)
+            len = piece_size;
+        if (verify_v2_read(fd, buf->piece, len) != len) {
+            fprintf(stderr, "File is smaller than in the torrent: %s\n", f->path);
+            goto end;
+        }
+        /* This accounts the hashing of the previous piece too */
+        throttle_read(len);
+
+        long int leaf_count = (len + VERIFY_V2_BLOCK_SIZE - 1) / VERIFY_V2_BLOCK_SIZE;
+        for (long int b = 0; b < leaf_count; b++) {
+            long int blen = len - b * VERIFY_V2_BLOCK_SIZE;
+            if (blen > VERIFY_V2_BLOCK_SIZE)
+                blen = VERIFY_V2_BLOCK_SIZE;
+            sha256(buf->piece + b * VERIFY_V2_BLOCK_SIZE, blen, buf->leaves[b]);
+        }
+
+        /* A file that fits in a piece only has the root, of its own width */
+        long int width = (piece_count == 1) ? verify_v2_pow2(leaf_count) : blocks_per_piece;
+        verify_v2_merkle_root(buf->leaves, leaf_count, width, zero, buf->pieces[p]);
+
+        if (piece_count > 1 && memcmp(buf->pieces[p], f->layer[p], sizeof(sha256sum_t)) != 0) {
+            fprintf(stderr, "Error at piece: %ld of file: %s\n", p, f->path);
+            goto end;
+        }
+    }
+
+    if (verify_v2_read(fd, &extra, 1) != 0) {
+        fprintf(stderr, "File is larger than in the torrent: %s\n", f->path);
+        goto end;
+    }
+
+    if (piece_count > 1) {
+        /* The piece layer is padded with the roots of empty pieces */
+        sha256sum_t pad;
+        memset(pad, 0, sizeof(pad));
+        for (long int w = blocks_per_piece; w > 1; w /= 2)
+            verify_v2_hash_pair(pad, pad, pad);
+        verify_v2_merkle_root(buf->pieces, piece_count, \
+                verify_v2_pow2(piece_count), pad, buf->pieces[0]);
+    }
+    if (piece_count > 0 && memcmp(buf->pieces[0], f->pieces_root, sizeof(sha256sum_t)) != 0) {
+        fprintf(stderr, "Hash tree root doesn't match for: %s\n", f->path);
+        goto end;
+    }
+    result = 0;
+
+end:
+    close(fd);
+    return result;
+}
+
+/*
+ * Mark the verification as failed, the workers stop taking files
+ */
+static void verify_v2_fail(verify_v2_data_t* vd) {
+#ifdef MT
+    pthread_mutex_lock(&vd->mut);
+#endif
+    vd->result = -1;
+#ifdef MT
+    pthread_mutex_unlock(&vd->mut);
+#endif
+}
+
+/*
+ * Verify files until there is none left, or one fails
+ */
+static void* verify_v2_worker(void* param) {
+    verify_v2_data_t* vd = (verify_v2_data_t*)param;
+    long int piece_size = metainfo_piece_size(vd->metai);
+    verify_v2_buffers_t buf = {0};
+
+    buf.piece = malloc(piece_size);
+    buf.leaves = malloc(piece_size / VERIFY_V2_BLOCK_SIZE * sizeof(sha256sum_t));
+    if (!buf.piece || !buf.leaves) {
+        fprintf(stderr, "Can't allocate piece buffer\n");
+        verify_v2_fail(vd);
+        goto end;
+    }
+
+    for (;;) {
+#ifdef MT
+        pthread_mutex_lock(&vd->mut);
+#endif
+        int index = (vd->result == 0) ? vd->file_next++ : vd->file_count;
+        if (index < vd->file_count && !opt_silent)
+            printf("[%d/%d] Verifying file: %s\n", index + 1, vd->file_count, \
+                    vd->files[index].path);
+#ifdef MT
+        pthread_mutex_unlock(&vd->mut);
+#endif
+        if (index >= vd->file_count)
+            break;
+
+        if (verify_v2_file(vd->metai, &vd->files[index], &buf) == -1)
+            verify_v2_fail(vd);
+    }
+
+end:
+    free(buf.piece);
+    free(buf.leaves);
+    free(buf.pieces);
+    return NULL;
+}
+
+/*
+ * Collect the files from the file tree, with their full paths
+ * Returns the number of files, or -1 on error
+ */
+static int verify_v2_collect(metainfo_t* m, const char* data_dir, \
+        int append_folder, verify_v2_file_t** out_files) {
+    filetree_iter_t iter;
+    filetree_info_t finfo;
+    verify_v2_file_t* files = NULL;
+    int count = 0, size = 0, total = 0, next;
+    char* path = NULL;
+
+    if (metainfo_filetree_create(m, &iter) == -1)
+        return -1;
+    /* Every file is verified on its own, the ones not selected are left out */
+    for (; (next = metainfo_filetree_next(&iter, &finfo)) == 0; total++) {
+        int path_len = metainfo_filetree_path(&finfo, NULL);
+        if (!(path = malloc(path_len + 1)))
+            goto error;
+        metainfo_filetree_path(&finfo, path);
+        path[path_len] = '\0';
+        if (!opts_only_file(path, total)) {
+            free(path);
+            path = NULL;
+            continue;
+        }
+
+        if (count == size) {
+            size = (size) ? size * 2 : 16;
+            verify_v2_file_t* n = realloc(files, size * sizeof(verify_v2_file_t));
+            if (!n)
+                goto error;
+            files = n;
+        }
+        verify_v2_file_t* f = &files[count];
+        memset(f, 0, sizeof(*f));
+        f->size = finfo.size;
+        f->pieces_root = finfo.pieces_root;
+        if (finfo.size > metainfo_piece_size(m))
+            metainfo_piece_layer(m, finfo.pieces_root, &f->layer, &f->layer_count);
+
+        /* Only the path for now, the prefix is added when it's known */
+        f->path = path;
+        path = NULL;
+        count++;
+    }
+    /* A bad entry would leave out every file after it */
+    if (next == -1)
+        goto error;
+
+    /* Like with v1, a single file is not in a folder */
+    const char* name = "";
+    int name_len = 0;
+    if (append_folder && !(total == 1 && count == 1 && strchr(files[0].path, '/') == NULL))
+        metainfo_name(m, &name, &name_len);
+
+    size_t data_dir_len = strlen(data_dir);
+    for (int i = 0; i < count; i++) {
+        size_t path_len = strlen(files[i].path);
+        char* full = malloc(data_dir_len + name_len + path_len + 3);
+        if (!full)
+            goto error;
+        /* This may include multiple /'s too */
+        sprintf(full, "%s/%.*s%s%s", data_dir, name_len, name, \
+                (name_len) ? "/" : "", files[i].path);
+        free(files[i].path);
+        files[i].path = full;
+    }
+
+    *out_files = files;
+    return count;
+
+error:
+    free(path);
+    for (int i = 0; i < count; i++)
+        free(files[i].path);
+    free(files);
+    return -1;
+}
+
+int verify_v2(metainfo_t* metai, const char* data_dir, int append_folder) {
+    verify_v2_file_t* files = NULL;
+    int result = 0;
+
+    long int piece_size = metainfo_piece_size(metai);
+    if (piece_size < VERIFY_V2_BLOCK_SIZE || (piece_size & (piece_size - 1)) != 0) {
+        fprintf(stderr, "Invalid piece length for a v2 torrent: %ld\n", piece_size);
+        return -1;
+    }
+
+    int file_count = verify_v2_collect(metai, data_dir, append_folder, &files);
+    if (file_count == -1) {
+        fprintf(stderr, "Can't read the file tree\n");
+        return -1;
+    }
+    if (file_count == 0 && (opt_only || opt_only_index >= 0)) {
+        fprintf(stderr, "No file is selected by --only or --only-index\n");
+        return -1;
+    }
+    if (file_count == 0) {
+        fprintf(stderr, "There is no file in the file tree\n");
+        return -1;
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        if (access(files[i].path, F_OK|R_OK) != 0) {
+            result = errno;
+            goto end;
+        }
+    }
+
+    verify_v2_data_t data = {0};
+    data.metai = metai;
+    data.files = files;
+    data.file_count = file_count;
+
+#ifdef MT
+    int thread_count = get_nprocs_conf();
+    if (thread_count > file_count)
+        thread_count = file_count;
+    if (thread_count < 1)
+        thread_count = 1;
+    pthread_t* threads = calloc(thread_count, sizeof(pthread_t));
+    pthread_mutex_init(&data.mut, NULL);
+
+    int started = 0;
+    for (; started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, verify_v2_worker, &data) != 0) {
+            perror("Thread creation failed: ");
+            break;
+        }
+    }
+    /* Do the work here too, if there is no thread at all */
+    if (started == 0)
+        verify_v2_worker(&data);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&data.mut);
+    free(threads);
+#else
+    verify_v2_worker(&data);
+#endif
+    result = data.result;
+
+end:
+    for (int i = 0; i < file_count; i++)
+        free(files[i].path);
+    free(files);
+    return result;
+}
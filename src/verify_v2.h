@@ -0,0 +1,14 @@
+#ifndef VERIFY_V2_H
+#define VERIFY_V2_H
+#include "metainfo.h"
+/* Verify BitTorrent v2 (BEP 52) torrents, with the per file merkle trees */
+
+/*
+ * Verify the files of a v2 or hybrid torrent. Every file has its own hash
+ * tree, so the files are verified independently, in parallel if there
+ * are threads.
+ * Same arguments and return value as verify()
+ */
+int verify_v2(metainfo_t* metai, const char* data_dir, int append_folder);
+
+#endif
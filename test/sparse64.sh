@@ -0,0 +1,100 @@
+#!/bin/bash
+# Verify sparse files of more than 4 GiB, so a size or an offset that's 32
+# bits anywhere breaks it: a single file with a piece length of more than
+# 4 GiB, and a torrent whose second file starts past 4 GiB. The files take
+# no space. The large pieces are only read with --io=mmap, the other ways
+# would need the memory for them.
+# Usage: test/sparse64.sh [torrent-verify]
+BIN=${1:-./torrent-verify}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/sparse64.XXXXXX") || exit 1
+trap 'rm -rf -- "$DIR"' EXIT
+
+G=$((1024 * 1024 * 1024))
+M=$((1024 * 1024))
+fail=0
+
+# Write a few bytes into the file at every offset
+mark() { # file offsets...
+    local file=$1 off
+    shift
+    for off in "$@"; do
+        printf 'ZZZZZZZ' | dd of="$file" bs=1 seek=$off conv=notrunc status=none || exit 1
+    done
+}
+
+# The piece hashes of the files one after the other, as \x escapes for printf
+pieces() { # piece_length files...
+    local plen=$1
+    shift
+    cat "$@" | split -b $plen --filter='sha1sum' | cut -c1-40 | tr -d '\n' | sed 's/../\\x&/g'
+}
+
+check() { # expect description args...
+    local expect=$1 what=$2
+    shift 2
+    "$BIN" "$@" > "$DIR/out" 2>&1
+    local res=$?
+    if [ $expect = ok -a $res -ne 0 ] || [ $expect = bad -a $res -eq 0 ]; then
+        echo "FAIL: $what"
+        cat "$DIR/out"
+        fail=1
+    fi
+}
+
+expect_out() { # description pattern
+    grep -q "$2" "$DIR/out" || { echo "FAIL: $1"; cat "$DIR/out"; fail=1; }
+}
+
+# A single file, with 2 pieces, the first one is larger than 4 GiB
+SIZE=$((5 * G + 12345))
+PLEN=$((4 * G + G / 2))
+FILE=$DIR/sparse
+truncate -s $SIZE "$FILE" || exit 1
+mark "$FILE" 1 $((4 * G + 9)) $((5 * G))
+printf "d8:announce1:x4:infod6:lengthi%de4:name6:sparse12:piece lengthi%de6:pieces40:$(pieces $PLEN "$FILE")ee" \
+    $SIZE $PLEN > "$DIR/sparse.torrent"
+
+check ok "piece length" -i "$DIR/sparse.torrent"
+expect_out "piece length is not $PLEN" "Piece size: $PLEN "
+check ok "single, mmap" -s --io=mmap -v "$DIR" "$DIR/sparse.torrent"
+
+# A bad byte past 4 GiB has to be found in the first piece
+printf 'X' | dd of="$FILE" bs=1 seek=$((4 * G + 10)) conv=notrunc status=none
+check bad "single, mmap, bad byte" --io=mmap -v "$DIR" "$DIR/sparse.torrent"
+expect_out "single, the bad piece is not 0" "Error at piece: 0"
+rm -f -- "$FILE"
+
+# 3 files, the second one starts past 4 GiB, in the middle of a piece
+PLEN=$((64 * M))
+A_SIZE=$((4 * G + 100))
+B_SIZE=$((G + 5))
+C_SIZE=1000
+MULTI=$DIR/multi
+mkdir "$MULTI" || exit 1
+truncate -s $A_SIZE "$MULTI/a" && truncate -s $B_SIZE "$MULTI/b" || exit 1
+mark "$MULTI/a" 1 $((4 * G + 50))
+mark "$MULTI/b" 0 $((G / 2)) $((G - 2))
+head -c $C_SIZE /dev/urandom > "$MULTI/c" || exit 1
+COUNT=$(( (A_SIZE + B_SIZE + C_SIZE + PLEN - 1) / PLEN ))
+printf "d8:announce1:x4:infod5:filesld6:lengthi%de4:pathl1:aeed6:lengthi%de4:pathl1:beed6:lengthi%de4:pathl1:ceee4:name5:multi12:piece lengthi%de6:pieces%d:$(pieces $PLEN "$MULTI/a" "$MULTI/b" "$MULTI/c")ee" \
+    $A_SIZE $B_SIZE $C_SIZE $PLEN $((COUNT * 20)) > "$DIR/multi.torrent"
+
+IOS="mmap pread"
+"$BIN" --io=uring -h > /dev/null 2>&1 && IOS="$IOS uring"
+for io in $IOS; do
+    check ok "multi, $io" -s --io=$io -v "$DIR" "$DIR/multi.torrent"
+done
+check ok "multi, full" -s --full -v "$DIR" "$DIR/multi.torrent"
+
+# The 4th byte of the second file is in the piece at 4 GiB + 103
+BAD=$(( (A_SIZE + 3) / PLEN ))
+printf 'X' | dd of="$MULTI/b" bs=1 seek=3 conv=notrunc status=none
+for io in $IOS; do
+    check bad "multi, $io, bad byte" --io=$io -v "$DIR" "$DIR/multi.torrent"
+    expect_out "multi, $io, the bad piece is not $BAD" "Error at piece: $BAD"
+done
+check bad "multi, full, bad byte" --full -v "$DIR" "$DIR/multi.torrent"
+expect_out "multi, full, there is not 1 bad piece" "Bad pieces: 1 of $COUNT"
+
+[ $fail = 0 ] && echo "sparse64: OK"
+exit $fail